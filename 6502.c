@@ -24,866 +24,894 @@
 //
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include "6502.h"
 
-#define IMMEDIATE 1
-#define ZERO_PAGE 2
-#define ZERO_PAGE_X 3
-#define ZERO_PAGE_Y 4
-#define ABSOLUTE 5
-#define ABSOLUTE_X 6
-#define ABSOLUTE_Y 7
-#define INDIRECT_X 8
-#define INDIRECT_Y 9
-#define IMPLIED 10
-#define ACCUMULATOR 11
-#define INDIRECT 12
-#define RELATIVE 13
+//
+// Dispatch engine used by the run loop, see run() below. Computed goto needs
+// the labels as values extension of gcc and clang, other compilers always 
+// use the switch.
+//
+#if defined(THREADED_DISPATCH) && !defined(__GNUC__)
+#undef THREADED_DISPATCH
+#endif
+
+//
+// The JIT compiler emits x86-64 code for the System V calling convention and
+// keeps the status register in a host register, so it needs gcc or clang on 
+// a 64 bit unix host and a build without LAZYFLAGS. Otherwise setjit fails.
+//
+#if defined(JIT) && !(defined(__GNUC__) && defined(__x86_64__) && defined(__unix__) && !defined(LAZYFLAGS))
+#undef JIT
+#endif
 
-// #define DEBUG
+#ifdef JIT
+#include <sys/mman.h>
+#endif
 
-unsigned char bordercross;
+//
+// The batch runner (see runbatch) spreads the cpus over POSIX threads on unix
+// hosts, and runs them all on the calling thread elsewhere.
+//
+#if defined(__unix__) || defined(__APPLE__)
+#define BATCH_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 // 
-// Read the next opcode from current pc value
+// Read the next opcode from current pc value. The pc is 16 bits wide, so it
+// wraps from 0xFFFF to 0 by itself.
 //
-__attribute((always_inline)) inline unsigned char fetchmemory()
+__attribute((always_inline)) static inline unsigned char fetchmemory(struct microprocessor *cpu)
 {
-    unsigned char result;
-    result = readmemory(cpu.pc);
-    if (cpu.pc<0xFFFF) cpu.pc++;
-    else cpu.pc=0;
-    return result;
+    return readmemory(cpu, cpu->pc++);
+} 
+
+//
+// Read a 16 bit operand (low byte first) from current pc value
+//
+__attribute((always_inline)) static inline unsigned short fetchword(struct microprocessor *cpu)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    operand_l = fetchmemory(cpu);
+    operand_h = fetchmemory(cpu);
+    return (unsigned short) ( operand_h << 8 | operand_l );
 } 
 
 //
-// Return address referenced by the addressing mode
+// Operands of the opcode being executed. opcodes.h uses these instead of 
+// calling fetchmemory, so an engine working on pre-decoded opcodes can supply
+// the operands itself.
+//
+#define OPERAND8 fetchmemory(cpu)
+#define OPERAND16 fetchword(cpu)
+
+//
+// Status flags. The handlers set and test the N, Z, C and V flags only through
+// these macros. The default build updates the bits of cpu->status right away.
+//
+// When built with NZTABLE, the N and Z bits are taken from a table indexed 
+// by the result and merged with a single mask-and-or, and C and V are set 
+// without branches either. Each flag update then has no conditional branch 
+// the host can mispredict. Code compiled by the JIT takes N and Z from the 
+// same table.
+//
+// When built with LAZYFLAGS, the handlers only store the last result (for N
+// and Z) and the carry and overflow bits in fields of their own, which is a
+// plain store instead of a read-modify-write of the status register. The
+// flags are packed into cpu->status by getstatus when the status register
+// itself is needed (php, brk, interrupts) and when the library returns to the
+// user code. Branches test the lazy fields directly. NZTABLE has no effect
+// on a LAZYFLAGS build.
+//
+#ifdef LAZYFLAGS
+#define SETNZ(value) (cpu->zresult = cpu->nresult = (value))
+#define SETZ(value)  (cpu->zresult = (value))
+#define SETN(value)  (cpu->nresult = (value))
+#define SETC(cond)   (cpu->carry = ((cond) != 0))
+#define SETV(cond)   (cpu->overflow = ((cond) != 0))
+#define FLAGC        (cpu->carry)
+#define FLAGZ        (!cpu->zresult)
+#define FLAGN        (cpu->nresult & 0x80)
+#define FLAGV        (cpu->overflow)
+#else
+#if defined(NZTABLE) || defined(JIT)
+                                           //     0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F
+static const unsigned char nztable[256]= { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 00
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 10
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 20
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 30
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 40
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 50
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 60
+                                           0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // 70
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // 80
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // 90
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // A0
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // B0
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // C0
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // D0
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,  // E0
+                                           0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };// F0
+#endif
+
+#if defined(NZTABLE)
+#define SETNZ(value) (cpu->status = (cpu->status & 0x7D) | nztable[(unsigned char) (value)])
+#define SETZ(value)  (cpu->status = (cpu->status & 0xFD) | (nztable[(unsigned char) (value)] & 0x02))
+#define SETN(value)  (cpu->status = (cpu->status & 0x7F) | ((value) & 0x80))
+#define SETC(cond)   (cpu->status = (cpu->status & 0xFE) | ((cond) != 0))
+#define SETV(cond)   (cpu->status = (cpu->status & 0xBF) | (((cond) != 0) << 6))
+#else
+#define SETNZ(value) do { unsigned char flagvalue = (value); \
+                          if (!flagvalue)      cpu->status |= 1UL << 1; else cpu->status &= ~(1UL << 1); \
+                          if (flagvalue>=0x80) cpu->status |= 1UL << 7; else cpu->status &= ~(1UL << 7); } while (0)
+#define SETZ(value)  do { if (!(unsigned char) (value)) cpu->status |= 1UL << 1; else cpu->status &= ~(1UL << 1); } while (0)
+#define SETN(value)  do { if ((value) & 0x80) cpu->status |= 1UL << 7; else cpu->status &= ~(1UL << 7); } while (0)
+#define SETC(cond)   do { if (cond) cpu->status |= 1UL << 0; else cpu->status &= ~(1UL << 0); } while (0)
+#define SETV(cond)   do { if (cond) cpu->status |= 1UL << 6; else cpu->status &= ~(1UL << 6); } while (0)
+#endif
+#define FLAGC        (cpu->status & 1UL << 0)
+#define FLAGZ        (cpu->status & 1UL << 1)
+#define FLAGN        (cpu->status & 1UL << 7)
+#define FLAGV        (cpu->status & 1UL << 6)
+#endif
+
+//
+// Status register with the flags packed in
+//
+__attribute((always_inline)) static inline unsigned char getstatus(struct microprocessor *cpu)
+{
+#ifdef LAZYFLAGS
+    return (cpu->status & 0x3C) | (cpu->nresult & 0x80) | (cpu->overflow << 6) | (cpu->zresult ? 0 : 0x02) | cpu->carry;
+#else
+    return cpu->status;
+#endif
+}
+
+//
+// Load the status register, unpacking the flags
+//
+__attribute((always_inline)) static inline void putstatus(struct microprocessor *cpu, unsigned char value)
+{
+    cpu->status = value;
+#ifdef LAZYFLAGS
+    cpu->nresult = value;
+    cpu->zresult = !(value & 0x02);
+    cpu->carry = value & 0x01;
+    cpu->overflow = (value >> 6) & 0x01;
+#endif
+}
+
+//
+// Called when the library is entered from and returns to the user code. The
+// user code only sees cpu->status, so the lazy flags are unpacked from it on
+// the way in and packed back on the way out.
+//
+__attribute((always_inline)) static inline void loadflags(struct microprocessor *cpu)
+{
+#ifdef LAZYFLAGS
+    cpu->running = 1;
+    putstatus(cpu, cpu->status);
+#endif
+}
+
+__attribute((always_inline)) static inline void storeflags(struct microprocessor *cpu)
+{
+#ifdef LAZYFLAGS
+    cpu->status = getstatus(cpu);
+    cpu->running = 0;
+#endif
+}
+
+//
+// Interrupt lines. The run loops only test cpu->signals between two opcodes,
+// and only do something when it is not zero: an nmi edge was seen, the irq
+// line is asserted while the interrupt flag is clear, or the interrupt flag 
+// was cleared by the last opcode. The irq bit is worked out again whenever 
+// the lines or the interrupt flag change, except after cli and plp: the 6502
+// checks for interrupts before those opcodes change the flag, so an irq 
+// waiting on the line is only taken after the next opcode. sei and a plp
+// setting the flag leave the irq bit alone, so an irq asserted before them 
+// is still taken right after them, as on the real chip. 
+//
+#define SIGNAL_NMI 0x01             // nmi edge seen, taken before the next opcode
+#define SIGNAL_IRQ 0x02             // irq line asserted with the interrupt flag clear
+#define SIGNAL_DELAY 0x04           // interrupt flag cleared by the last opcode
+
+__attribute((always_inline)) static inline void updateirq(struct microprocessor *cpu)
+{
+    if (cpu->irqlines && !(cpu->status & 0x04)) cpu->signals |= SIGNAL_IRQ;
+    else cpu->signals &= ~SIGNAL_IRQ;
+}
+
+__attribute((always_inline)) static inline void delayirq(struct microprocessor *cpu)
+{
+    if (cpu->irqlines) {
+        cpu->signals |= SIGNAL_DELAY;
+        cpu->breakblock = 1;
+    }
+}
+
+//
+// Keep the address referenced by the opcode for the trace record. A plain 
+// store, so the mode functions cost the same with the trace on or off.
+//
+__attribute((always_inline)) static inline unsigned short traceaddress(struct microprocessor *cpu, unsigned short address)
+{
+    cpu->address = address;
+    return address;
+}
+
+//
+// Addressing modes. There is one function per mode, taking the operand of 
+// the opcode and returning the address it references, so the opcode bodies
+// in opcodes.h select the mode at compile time and have no mode switch. 
+// Immediate, implied, accumulator and relative modes need no address.
 //
-__attribute((always_inline)) inline unsigned short get_address(unsigned char mode)
+__attribute((always_inline)) static inline unsigned short zeropage(struct microprocessor *cpu, unsigned char operand)
+{
+    return traceaddress(cpu, operand);
+}
+
+__attribute((always_inline)) static inline unsigned short zeropagex(struct microprocessor *cpu, unsigned char operand)
+{
+    return traceaddress(cpu, (operand + cpu->x) & 0xFF);
+}
+
+__attribute((always_inline)) static inline unsigned short zeropagey(struct microprocessor *cpu, unsigned char operand)
+{
+    return traceaddress(cpu, (operand + cpu->y) & 0xFF);
+}
+
+__attribute((always_inline)) static inline unsigned short absolute(struct microprocessor *cpu, unsigned short operand)
+{
+    return traceaddress(cpu, operand);
+}
+
+__attribute((always_inline)) static inline unsigned short absolutex(struct microprocessor *cpu, unsigned short operand)
+{
+    unsigned short address = operand + cpu->x;
+    if ((address & 0xFF00) != (operand & 0xFF00)) cpu->bordercross=1; 
+    return traceaddress(cpu, address);
+}
+
+__attribute((always_inline)) static inline unsigned short absolutey(struct microprocessor *cpu, unsigned short operand)
+{
+    unsigned short address = operand + cpu->y;
+    if ((address & 0xFF00) != (operand & 0xFF00)) cpu->bordercross=1; 
+    return traceaddress(cpu, address);
+}
+
+__attribute((always_inline)) static inline unsigned short indirect(struct microprocessor *cpu, unsigned short operand)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    // please note that the 6502 has a bug that causes it to take operand_h below
+    // from the same page if operand_l is on position 0xFF of the page. The 65C02
+    // fixes this bug. The implementation below follows the 6502 behaviour.
+    // 
+    // Note: The bug only occurs with the jmp opcode. 
+    operand_h = readmemory(cpu, (operand & 0xFF00) | ((operand + 1) & 0x00FF));
+    operand_l = readmemory(cpu, operand);
+    return traceaddress(cpu, (unsigned short) ( operand_h << 8 | operand_l ));
+}
+
+__attribute((always_inline)) static inline unsigned short indirectx(struct microprocessor *cpu, unsigned char operand)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    unsigned char pointer = operand + cpu->x;
+    operand_l = readmemory(cpu, pointer);
+    operand_h = readmemory(cpu, (unsigned char) (pointer + 1));
+    return traceaddress(cpu, (unsigned short) ( operand_h << 8 | operand_l ));
+}
+
+__attribute((always_inline)) static inline unsigned short indirecty(struct microprocessor *cpu, unsigned char operand)
 {
-    unsigned char operand;
     unsigned char operand_l;
     unsigned char operand_h;
     unsigned short address;
-    switch (mode) {
-	case ZERO_PAGE:
-	    operand = fetchmemory();
-	    address = (unsigned short) operand;
-	    break; 
-
-	case ZERO_PAGE_X:
-	    operand = fetchmemory();
-	    address = (unsigned short) operand + cpu.x;
-	    if (address>0xFF) address = address - 0x100;
-	    break; 
-
-	case ZERO_PAGE_Y:
-	    operand = fetchmemory();
-	    address = (unsigned short) operand + cpu.y;
-	    if (address>0xFF) address = address - 0x100;
-	    break; 
-
-	case ABSOLUTE:
-	    operand_l = fetchmemory();
-	    operand_h = fetchmemory();
-	    address = (unsigned short) ( operand_h << 8 | operand_l );
-	    break; 
-
-	case ABSOLUTE_X:
-	    operand_l = fetchmemory();
-	    operand_h = fetchmemory();
-	    address = (unsigned short) ( operand_h << 8 | operand_l ) + cpu.x;
-        if (((address & 0xFF00)>>8) != operand_h) bordercross=1; 
-	    break; 
-
-	case ABSOLUTE_Y:
-	    operand_l = fetchmemory();
-	    operand_h = fetchmemory();
-	    address = (unsigned short) ( operand_h << 8 | operand_l ) + cpu.y;
-        if (((address & 0xFF00)>>8) != operand_h) bordercross=1; 
-	    break; 
-
-    case INDIRECT:
-        operand_l = fetchmemory();
-        operand_h = fetchmemory();
-	    address = (unsigned short) ( operand_h << 8 | operand_l );
-        // please note that the 6502 has a bug that causes it to take operand_h below
-        // from the same page if operand_l is on position 0xFF of the page. The 65C02
-        // fixes this bug. The implementation below follows the 6502 behaviour.
-        // 
-        // Note: The bug only occurs with the jmp opcode. 
-        if (operand_l == 0xFF) operand_h = readmemory(address-255);
-        else operand_h = readmemory(address+1);
-        operand_l = readmemory(address);
-	    address = (unsigned short) ( operand_h << 8 | operand_l );
-        break;
+    operand_l = readmemory(cpu, operand);
+    operand_h = readmemory(cpu, (unsigned char) (operand + 1));
+    address = (unsigned short) ( operand_h << 8 | operand_l ) + cpu->y;
+    if (((address & 0xFF00)>>8) != operand_h) cpu->bordercross=1; 
+    return traceaddress(cpu, address);
+}
 
-	case INDIRECT_X:
-	    operand = fetchmemory();
-	    address = (unsigned short) operand + cpu.x;
-	    if (address>0xFF) address = address - 0x100;
-	    operand_l = readmemory(address);
-	    if (address<0xFF) operand_h = readmemory(address+1);
-	    else operand_h = readmemory(0x0000);
-	    address = (unsigned short) ( operand_h << 8 | operand_l );
-	    break; 
-
-	case INDIRECT_Y:
-	    operand = fetchmemory();
-	    address = (unsigned short) operand;
-	    operand_l = readmemory(address);
-	    if (address<0xFF) operand_h = readmemory(address+1);
-	    else operand_h = readmemory(0x0000);
-	    address = (unsigned short) ( operand_h << 8 | operand_l ) + cpu.y;
-        if (((address & 0xFF00)>>8) != operand_h) bordercross=1; 
-	    break; 
-	}
-#ifdef DEBUG
-    fprintf (stderr, "%04X ", address);
-#endif 
-    used=1;
-	return address;
-}
-
-__attribute((always_inline)) inline void adc (unsigned char mode) 
+//
+// Opcode handlers. Handlers reading memory take the value read (or the 
+// immediate operand), handlers writing or modifying memory take the address,
+// and handlers of implied opcodes only take the cpu. 
+//
+__attribute((always_inline)) static inline void adcdecimal (struct microprocessor *cpu, unsigned char operand) 
 {
     short sum; 
     char al;
     unsigned char altsum, binsum; 
-    unsigned char operand;
-#ifdef DEBUG
-    fprintf(stderr,"adc ");
-#endif
-    if (mode==IMMEDIATE) operand = fetchmemory();
-    else operand = readmemory(get_address(mode));
- 
-    if (cpu.status & 1UL<<0) sum = cpu.a + operand + 1; 
-    else                     sum = cpu.a + operand;
 
-    // 
-    // Decimal flag is set calculate decimal adc
-    //
-    if ((cpu.status & 1UL<<3)>>3) { 
+    if (FLAGC) al = (cpu->a & 0x0F) + (operand & 0x0F) + 1;  
+    else       al = (cpu->a & 0x0F) + (operand & 0x0F);
+    if (al>=0x0A) al = ((al + 0x06) & 0x0F) + 0x10;
 
-        if (cpu.status & 1UL<<0) al = (cpu.a & 0x0F) + (operand & 0x0F) + 1;  
-        else                     al = (cpu.a & 0x0F) + (operand & 0x0F);
-        if (al>=0x0A) al = ((al + 0x06) & 0x0F) + 0x10;
+    binsum = cpu->a + operand + (FLAGC ? 1 : 0);
+    sum    = (cpu->a & 0xF0) + (operand & 0xF0) + al;
+    altsum = (char) sum;
+    if (sum>=0xA0) sum += 0x60; 
 
-        binsum = (char) sum;
-        sum    = (cpu.a & 0xF0) + (operand & 0xF0) + al;
-        altsum = (char) sum;
-        if (sum>=0xA0) sum += 0x60; 
+    // set bit carry on status processor
+    SETC(sum>0xFF); 
 
-        // set bit carry on status processor
-        if (sum>0xFF) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0); 
+    // set bit zero on status processor 
+    SETZ(binsum);
+
+    // set bit negative on status processor
+    SETN(altsum);
+
+    // set bit overflow   
+    SETV(~(cpu->a ^ operand) & (cpu->a ^ altsum) & 0x80);
+
+    cpu->a = (char) sum;
+}
+
+__attribute((always_inline)) static inline void sbcdecimal (struct microprocessor *cpu, unsigned char operand) 
+{
+    short sum; 
+    unsigned char binsum;
+    int al;
+
+    if (FLAGC) {                                    // If carry set
+        binsum = cpu->a + (operand^0xFFU) + 1; 
+        al = (cpu->a & 0x0F) - (operand & 0x0F);     
+    }
+    else {                                          // If carry clear
+        binsum = cpu->a + (operand^0xFFU);
+        al = (cpu->a & 0x0F) - (operand & 0x0F) - 1; 
+    }
+    if (al<0) al = ((al - 0x06) & 0x0F) - 0x10;
+    sum = (cpu->a & 0xF0) - (operand & 0xF0) + al;
+    if (sum<0) sum -= 0x60; 
+    SETC(sum>=0);                   // set bit carry on status processor 
+    SETNZ(binsum);                  // set bits zero and negative on status processor
+    SETV(~(cpu->a ^ (operand^0xFFU)) & (cpu->a ^ binsum) & 0x80); // set bit overflow   
+    cpu->a = (char) sum;
+}
 
-        // set bit zero on status processor 
-        if (!binsum)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  
+#ifdef DECIMALTABLE
+//
+// Decimal mode tables. The result of every decimal adc and sbc, indexed by
+// opcode (0 adc, 1 sbc), carry, accumulator and operand, is stored as the 
+// new accumulator in the low byte and the N, Z, C and V flags in the high 
+// byte. The tables take 512K and are filled the first time the cpu runs a 
+// decimal adc or sbc, by running the handlers above on a scratch context, 
+// so they always agree with them. Several threads may get there at once when
+// cpus run in parallel, so only one fills them and the others wait for it.
+//
+static unsigned short decimaltable[2][2][256][256];
+static unsigned char decimalready;
+
+static void filldecimal(void)
+{
+    struct microprocessor scratch;
+    int subtract, carry, a, operand;
+
+    for (subtract=0; subtract<2; subtract++)
+        for (carry=0; carry<2; carry++)
+            for (a=0; a<256; a++)
+                for (operand=0; operand<256; operand++) {
+                    scratch.a = a;
+                    putstatus(&scratch, 0x28 | carry);
+                    if (subtract) sbcdecimal(&scratch, operand);
+                    else          adcdecimal(&scratch, operand);
+                    decimaltable[subtract][carry][a][operand] = scratch.a | (getstatus(&scratch) & 0xC3) << 8;
+                }
+    __atomic_store_n(&decimalready, 1, __ATOMIC_RELEASE);
+}
+
+__attribute((noinline, cold)) static void builddecimal(void)
+{
+#ifdef BATCH_THREADS
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, filldecimal);
+#else
+    filldecimal();
+#endif
+}
 
-        // set bit negative on status processor
-        if (altsum>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); 
+__attribute((always_inline)) static inline void decimal (struct microprocessor *cpu, int subtract, unsigned char operand) 
+{
+    unsigned short result;
+    if (__builtin_expect(!__atomic_load_n(&decimalready, __ATOMIC_ACQUIRE), 0)) builddecimal();
+    result = decimaltable[subtract][FLAGC ? 1 : 0][cpu->a][operand];
+    cpu->a = (unsigned char) result;
+    putstatus(cpu, (cpu->status & 0x3C) | (result >> 8));
+}
+#endif
 
-        // set bit overflow   
-        if ((!((cpu.a ^ operand) & 0x80) && ((cpu.a ^ altsum) & 0x80))!=0) 
-            cpu.status |= 1UL << 6; else cpu.status &= ~(1UL << 6); 
+__attribute((always_inline)) static inline void adc (struct microprocessor *cpu, unsigned char operand) 
+{
+    short sum; 
 
-        cpu.a = (char) sum;
+    // 
+    // Decimal flag is set calculate decimal adc
+    //
+    if ((cpu->status & 1UL<<3)>>3) { 
+#ifdef DECIMALTABLE
+        decimal(cpu, 0, operand);
+#else
+        adcdecimal(cpu, operand);
+#endif
     }
     // 
     // Decimal flag is not set, calculate binary adc
     //
     else {
+        if (FLAGC) sum = cpu->a + operand + 1; 
+        else       sum = cpu->a + operand;
 
         // set bit carry on status processor
-        if (sum>0xFF)  cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);  
+        SETC(sum>0xFF);  
 
         // set bit overflow on status processor
-        if ((!((cpu.a ^ operand) & 0x80) && ((cpu.a ^ sum) & 0x80))!=0) 
-            cpu.status |= 1UL << 6; else cpu.status &= ~(1UL << 6); 
+        SETV(~(cpu->a ^ operand) & (cpu->a ^ sum) & 0x80);
 
-        cpu.a = (char) sum; 
+        cpu->a = (char) sum; 
 
-        // set bit zero on status processor 
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  
-
-        // set bit negative on status processor
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  
+        // set bits zero and negative on status processor 
+        SETNZ(cpu->a);
 
     }
 
 }
 
-__attribute((always_inline)) inline void fand (unsigned char mode) 
+__attribute((always_inline)) static inline void fand (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"and ");
-#endif 
-    if (mode==IMMEDIATE) cpu.a &= fetchmemory();
-    else cpu.a &= readmemory(get_address(mode));
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->a &= value;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
     
-__attribute((always_inline)) inline void asl (unsigned char mode) 
+//
+// Shifts and rotations of a value, setting the carry. Shared by the 
+// accumulator and memory versions of the opcodes, the undocumented opcodes
+// built on them and the cycle exact engine, which do the bus accesses and 
+// set N and Z themselves.
+//
+__attribute((always_inline)) static inline unsigned char shiftleft (struct microprocessor *cpu, unsigned char val) 
 {
-    unsigned short aux;
-    unsigned short val;
-#ifdef DEBUG
-    fprintf(stderr,"asl ");
-#endif 
-    if (mode==ACCUMULATOR)
-    {
-        if (cpu.a>=0x80) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0); // set bit carry on status processor
-        cpu.a &= ~(1UL << 7);                                                    // set bit 7 of accumulator to 0
-        cpu.a = cpu.a << 1;       
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-    }
-    else
-    {
-        aux = get_address(mode);
-        val = readmemory(aux);
-        if (val>=0x80) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0); // set bit carry on status processor to true
-        val &= ~(1UL << 7);                                                    // set bit 7 of input to 0
-        val = val << 1;
-        writememory ( aux, val );
-        if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor to true
-        if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
-    }
+    SETC(val>=0x80); // set bit carry on status processor to bit 7
+    return (unsigned char) (val << 1);
+}
+
+__attribute((always_inline)) static inline unsigned char shiftright (struct microprocessor *cpu, unsigned char val) 
+{
+    SETC(val & 1UL << 0); // set bit carry on status processor to bit zero
+    return val >> 1;
+}
+
+__attribute((always_inline)) static inline unsigned char rotateleft (struct microprocessor *cpu, unsigned char val) 
+{
+    unsigned char tmp;
+    tmp = FLAGC;
+    SETC((val & (1UL << 7)) >> 7); // set bit carry on status processor to bit 7
+    val = val << 1;       
+    return (val & ~(1UL << 0)) | (tmp & (1UL << 0)); // set bit zero to previous carry
+}
+
+__attribute((always_inline)) static inline unsigned char rotateright (struct microprocessor *cpu, unsigned char val) 
+{
+    unsigned char tmp;
+    tmp = FLAGC;
+    SETC(val & (1UL << 0)); // set bit carry on status processor to bit 0
+    val = val >> 1;       
+    return (val & ~(1UL << 7)) | ((tmp & (1UL << 0)) << 7); // set bit 7 to previous carry
+}
+
+__attribute((always_inline)) static inline void asla (struct microprocessor *cpu) 
+{
+    cpu->a = shiftleft(cpu, cpu->a);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void asl (struct microprocessor *cpu, unsigned short aux) 
+{
+    unsigned char val;
+    val = shiftleft(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val );
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void bcc (unsigned char mode) 
+__attribute((always_inline)) static inline void bcc (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bcc ");
-#endif 
-    branch= fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (!(cpu.status & (1UL << 0)))
+    currpage = (cpu->pc & 0xFF00);
+    if (!FLAGC)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void bcs (unsigned char mode) 
+__attribute((always_inline)) static inline void bcs (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bcs ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (cpu.status & (1UL << 0))
+    currpage = (cpu->pc & 0xFF00);
+    if (FLAGC)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void beq (unsigned char mode) 
+__attribute((always_inline)) static inline void beq (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"beq ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (cpu.status & (1UL << 1))
+    currpage = (cpu->pc & 0xFF00);
+    if (FLAGZ)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void bit (unsigned char mode) 
+__attribute((always_inline)) static inline void bit (struct microprocessor *cpu, unsigned char val) 
 {
-    unsigned short aux;
-    unsigned char val;
-#ifdef DEBUG
-    fprintf(stderr,"bit ");
-#endif 
-    aux = get_address(mode);
-    val = readmemory(aux);
-    if (!(val & cpu.a)) cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor
-    cpu.status = ((cpu.status & ~(1UL << 6)) | (val & 1UL << 6)); // set bit overflow on status processor to 6th bit of memory
-    cpu.status = ((cpu.status & ~(1UL << 7)) | (val & 1UL << 7)); // set bit negative on status processor to 7th bit of memory
+    SETZ(val & cpu->a);  // set bit zero on status processor
+    SETV(val & 1UL << 6); // set bit overflow on status processor to 6th bit of memory
+    SETN(val);           // set bit negative on status processor to 7th bit of memory
 }
 
-__attribute((always_inline)) inline void bmi (unsigned char mode) 
+__attribute((always_inline)) static inline void bmi (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bmi ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (cpu.status & (1UL << 7))
+    currpage = (cpu->pc & 0xFF00);
+    if (FLAGN)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void bne (unsigned char mode) 
+__attribute((always_inline)) static inline void bne (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bne ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (!(cpu.status & (1UL << 1)))
+    currpage = (cpu->pc & 0xFF00);
+    if (!FLAGZ)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void bpl (unsigned char mode) 
+__attribute((always_inline)) static inline void bpl (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bpl ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (!(cpu.status & (1UL << 7)))
+    currpage = (cpu->pc & 0xFF00);
+    if (!FLAGN)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void fbrk (unsigned char mode)
+__attribute((always_inline)) static inline void fbrk (struct microprocessor *cpu)
 {
     unsigned char operand_l, operand_h;
-#ifdef DEBUG
-    fprintf(stderr,"brk ");
-#endif 
-    operand_l = (char) (cpu.pc+1);
-    operand_h = (char) ((cpu.pc+1)>>8);
-    writememory(0x100+cpu.sp, operand_h);
-    cpu.sp--;
-    writememory(0x100+cpu.sp, operand_l);
-    cpu.sp--;
-    writememory(0x100+cpu.sp, cpu.status | 0x30);  // set bits break and reserved to true on the stack copy of the status register
-    cpu.sp--;
-    cpu.status |= 0x04;
-    operand_l = readmemory(0xFFFE);
-    operand_h = readmemory(0xFFFF);
-    cpu.pc = (operand_h << 8) + operand_l;
-}
-
-
-__attribute((always_inline)) inline void bvc (unsigned char mode) 
-{
-    unsigned char branch;
+    operand_l = (char) (cpu->pc+1);
+    operand_h = (char) ((cpu->pc+1)>>8);
+    writememory(cpu, 0x100+cpu->sp, operand_h);
+    cpu->sp--;
+    writememory(cpu, 0x100+cpu->sp, operand_l);
+    cpu->sp--;
+    writememory(cpu, 0x100+cpu->sp, getstatus(cpu) | 0x30);  // set bits break and reserved to true on the stack copy of the status register
+    cpu->sp--;
+    cpu->status |= 0x04;
+    cpu->signals &= ~SIGNAL_IRQ;
+    operand_l = readmemory(cpu, 0xFFFE);
+    operand_h = readmemory(cpu, 0xFFFF);
+    cpu->pc = (operand_h << 8) + operand_l;
+}
+
+
+__attribute((always_inline)) static inline void bvc (struct microprocessor *cpu, unsigned char branch) 
+{
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bvc ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if (!(cpu.status & (1UL << 6)))
+    currpage = (cpu->pc & 0xFF00);
+    if (!FLAGV)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void bvs (unsigned char mode) 
+__attribute((always_inline)) static inline void bvs (struct microprocessor *cpu, unsigned char branch) 
 {
-    unsigned char branch;
     unsigned short currpage;
-#ifdef DEBUG
-    fprintf(stderr,"bvs ");
-#endif 
-    branch=fetchmemory();
-    currpage = (cpu.pc & 0xFF00);
-    if ((cpu.status & (1UL << 6)))
+    currpage = (cpu->pc & 0xFF00);
+    if (FLAGV)
     {
-       if (branch>=0x80) cpu.pc -= (0x100 - branch);
-       else              cpu.pc += branch;
-       cpu.cycles += 1;
+       if (branch>=0x80) cpu->pc -= (0x100 - branch);
+       else              cpu->pc += branch;
+       cpu->cycles += 1;
     }
-    if ((cpu.pc & 0xFF00) != currpage) cpu.cycles += 1;
+    if ((cpu->pc & 0xFF00) != currpage) cpu->cycles += 1;
 }
 
-__attribute((always_inline)) inline void clc (unsigned char mode)
+__attribute((always_inline)) static inline void clc (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"clc ");
-#endif 
-    cpu.status &= ~(1UL << 0);     // clear bit carry on status processor to true
+    SETC(0);                        // clear bit carry on status processor to true
 }
 
-__attribute((always_inline)) inline void cld (unsigned char mode)
+__attribute((always_inline)) static inline void cld (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"cld ");
-#endif 
-    cpu.status &= ~(1UL << 3);     // clear bit decimal on status processor to true
+    cpu->status &= ~(1UL << 3);     // clear bit decimal on status processor to true
 }
 
-__attribute((always_inline)) inline void cli (unsigned char mode)
+__attribute((always_inline)) static inline void cli (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"cli ");
-#endif 
-    cpu.status &= ~(1UL << 2);     // clear bit interrupt on status processor to true (interrupt disabled)
+    cpu->status &= ~(1UL << 2);     // clear bit interrupt on status processor to true (interrupt disabled)
+    delayirq(cpu);
 }
 
-__attribute((always_inline)) inline void clv (unsigned char mode)
+__attribute((always_inline)) static inline void clv (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"clv ");
-#endif 
-    cpu.status &= ~(1UL << 6);     // clear bit overflow on status processor to true (interrupt disabled)
+    SETV(0);                        // clear bit overflow on status processor to true (interrupt disabled)
 }
 
-__attribute((always_inline)) inline void cmp (unsigned char mode) 
+__attribute((always_inline)) static inline void cmp (struct microprocessor *cpu, unsigned char tmp) 
 {
-    unsigned char tmp;
-#ifdef DEBUG
-    fprintf(stderr,"cmp ");
-#endif 
-    if (mode==IMMEDIATE) tmp = fetchmemory(); 
-    else tmp = readmemory(get_address(mode));
-
-    if (cpu.a >= tmp) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);               // set bit carry on status processor to true
-    if (cpu.a == tmp) cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);               // set bit zero on status processor to true
-    if ((cpu.a - tmp) & (1UL << 7)) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
+    SETC(cpu->a >= tmp);               // set bit carry on status processor to true
+    SETNZ(cpu->a - tmp);               // set bits zero and negative on status processor
 }
     
-__attribute((always_inline)) inline void cpx (unsigned char mode) 
+__attribute((always_inline)) static inline void cpx (struct microprocessor *cpu, unsigned char tmp) 
 {
-    unsigned char tmp;
-#ifdef DEBUG
-    fprintf(stderr,"cpx ");
-#endif 
-    if (mode==IMMEDIATE) tmp = fetchmemory();
-    else tmp = readmemory(get_address(mode));
-
-    if (cpu.x >= tmp) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);               // set bit carry on status processor to true
-    if (cpu.x == tmp) cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);               // set bit zero on status processor to true
-    if ((cpu.x - tmp) & (1UL << 7)) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
+    SETC(cpu->x >= tmp);               // set bit carry on status processor to true
+    SETNZ(cpu->x - tmp);               // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void cpy (unsigned char mode) 
+__attribute((always_inline)) static inline void cpy (struct microprocessor *cpu, unsigned char tmp) 
 {
-    unsigned char tmp;
-#ifdef DEBUG
-    fprintf(stderr,"cpy ");
-#endif 
-    if (mode==IMMEDIATE) tmp = fetchmemory();
-    else tmp = readmemory(get_address(mode));
-
-    if (cpu.y >= tmp) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);               // set bit carry on status processor to true
-    if (cpu.y == tmp) cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);               // set bit zero on status processor to true
-    if ((cpu.y - tmp) & (1UL << 7)) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
+    SETC(cpu->y >= tmp);               // set bit carry on status processor to true
+    SETNZ(cpu->y - tmp);               // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void dec (unsigned char mode) 
+__attribute((always_inline)) static inline void dec (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned short aux;
     unsigned short val;
-#ifdef DEBUG
-    fprintf(stderr,"dec ");
-#endif 
-    aux = get_address(mode);
-    val = readmemory(aux);
+    val = readmemory(cpu, aux);
     val--;
-    writememory(aux, val);
+    writememory(cpu, aux, val);
 
-    if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void dex (unsigned char mode) 
+__attribute((always_inline)) static inline void dex (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"dex ");
-#endif 
-    if (cpu.x!=0x00) cpu.x--; 
-    else cpu.x=0xFF;
-    if (!cpu.x)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.x>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    if (cpu->x!=0x00) cpu->x--; 
+    else cpu->x=0xFF;
+    SETNZ(cpu->x);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void dey (unsigned char mode) 
+__attribute((always_inline)) static inline void dey (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"dey ");
-#endif 
-    if (cpu.y!=0x00) cpu.y--; 
-    else cpu.y=0xFF;
-    if (!cpu.y)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.y>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    if (cpu->y!=0x00) cpu->y--; 
+    else cpu->y=0xFF;
+    SETNZ(cpu->y);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void eor (unsigned char mode) 
+__attribute((always_inline)) static inline void eor (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"eor ");
-#endif 
-    if (mode==IMMEDIATE) cpu.a = cpu.a ^ fetchmemory();
-    else cpu.a = cpu.a ^ readmemory(get_address(mode));
+    cpu->a = cpu->a ^ value;
 
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void inc (unsigned char mode) 
+__attribute((always_inline)) static inline void inc (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned short aux;
     unsigned short val;
-#ifdef DEBUG
-    fprintf(stderr,"inc ");
-#endif 
-    aux = get_address(mode);
-    val = readmemory(aux);
+    val = readmemory(cpu, aux);
     if (val!=0xFF) val++;
     else val=0;
-    writememory(aux, val);
+    writememory(cpu, aux, val);
 
-    if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor to true
-    if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void inx (unsigned char mode) 
+__attribute((always_inline)) static inline void inx (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"inx ");
-#endif 
-    if (cpu.x!=0xFF) cpu.x++; 
-    else cpu.x=0;
+    if (cpu->x!=0xFF) cpu->x++; 
+    else cpu->x=0;
 
-    if (!cpu.x)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.x>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->x);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void iny (unsigned char mode) 
+__attribute((always_inline)) static inline void iny (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"iny ");
-#endif 
-    if (cpu.y!=0xFF) cpu.y++; 
-    else cpu.y=0;
+    if (cpu->y!=0xFF) cpu->y++; 
+    else cpu->y=0;
 
-    if (!cpu.y)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.y>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->y);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void jmp (unsigned char mode) 
+__attribute((always_inline)) static inline void jmp (struct microprocessor *cpu, unsigned short address) 
 {
-    unsigned char lowbyte, highbyte;
-#ifdef DEBUG
-    fprintf(stderr,"jmp ");
-#endif 
-    if (mode==ABSOLUTE) 
-    {
-        lowbyte=fetchmemory();
-        highbyte=fetchmemory();
-        cpu.pc= (unsigned short) (highbyte<<8) | lowbyte;
-    }
-    else
-    {
-        cpu.pc = get_address(mode);
-    }
+    cpu->pc = address;
 }
 
-__attribute((always_inline)) inline void jsr (unsigned char mode) 
+__attribute((always_inline)) static inline void jsr (struct microprocessor *cpu, unsigned short address) 
 {
     unsigned char operand_l, operand_h;
-    operand_l = (char) (cpu.pc+1);
-    operand_h = (char) ((cpu.pc+1)>>8);
-    writememory(0x100+cpu.sp, operand_h);
-    cpu.sp--;
-    writememory(0x100+cpu.sp, operand_l);
-    cpu.sp--;
-	operand_l = fetchmemory();
-	operand_h = fetchmemory();
-	cpu.pc = (unsigned short) (operand_h << 8) | operand_l;
-    used=1;
-#ifdef DEBUG
-    fprintf(stderr,"jsr %04X ", cpu.pc);
-#endif 
+    // the pc points past the operand, the return address pushed is the 
+    // address of the last operand byte
+    operand_l = (char) (cpu->pc-1);
+    operand_h = (char) ((cpu->pc-1)>>8);
+    writememory(cpu, 0x100+cpu->sp, operand_h);
+    cpu->sp--;
+    writememory(cpu, 0x100+cpu->sp, operand_l);
+    cpu->sp--;
+	cpu->pc = address;
 }
 
-__attribute((always_inline)) inline void lda (unsigned char mode) 
+__attribute((always_inline)) static inline void lda (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"lda ");
-#endif 
-    if (mode==IMMEDIATE) cpu.a=fetchmemory(); 
-    else cpu.a=readmemory(get_address(mode));
+    cpu->a=value;
 
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void ldx (unsigned char mode) 
+__attribute((always_inline)) static inline void ldx (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"ldx ");
-#endif 
-    if (mode==IMMEDIATE) cpu.x=fetchmemory(); 
-    else cpu.x=readmemory(get_address(mode));
+    cpu->x=value;
 
-    if (!cpu.x)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.x>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->x);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void ldy (unsigned char mode) 
+__attribute((always_inline)) static inline void ldy (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"ldy ");
-#endif 
-    if (mode==IMMEDIATE) cpu.y=fetchmemory(); 
-    else cpu.y=readmemory(get_address(mode));
+    cpu->y=value;
 
-    if (!cpu.y)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.y>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->y);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void lsr (unsigned char mode) 
+__attribute((always_inline)) static inline void lsra (struct microprocessor *cpu) 
 {
-    unsigned short val;
-    unsigned short aux;
-#ifdef DEBUG
-    fprintf(stderr,"lsr ");
-#endif 
-    if (mode==ACCUMULATOR)
-    {
-        cpu.status = (cpu.status & ~(1UL << 0)) | (cpu.a & 1UL << 0); // set bit carry on status processor to accumulator bit zero
-        cpu.a = cpu.a >> 1;       
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-    }
-    else
-    {
-        aux = get_address(mode);
-        val = readmemory(aux);
-        cpu.status = (cpu.status & ~(1UL << 0)) | (val & 1UL << 0); // set bit carry on status processor to memory bit zero
-        val = val >> 1;
-        writememory ( aux, val );
-        if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor to true
-        if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
-    }
+    cpu->a = shiftright(cpu, cpu->a);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void lsr (struct microprocessor *cpu, unsigned short aux) 
+{
+    unsigned char val;
+    val = shiftright(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val );
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void nop (unsigned char mode)
+__attribute((always_inline)) static inline void nop (struct microprocessor *cpu, unsigned short operand)
 {
-    // do nothing
-#ifdef DEBUG
-    fprintf(stderr,"nop ");
-#endif 
-    if (mode==IMMEDIATE) fetchmemory();
-    else if (mode!=IMPLIED) get_address(mode);
+    // do nothing, the operand (if any) was already fetched
     return;
 }
 
-__attribute((always_inline)) inline void ora (unsigned char mode) 
+__attribute((always_inline)) static inline void ora (struct microprocessor *cpu, unsigned char value) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"ora ");
-#endif 
-    if (mode==IMMEDIATE) cpu.a = cpu.a | fetchmemory();
-    else cpu.a = cpu.a | readmemory(get_address(mode));
+    cpu->a = cpu->a | value;
      
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void pha (unsigned char mode) 
+__attribute((always_inline)) static inline void pha (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"pha ");
-#endif 
-    writememory(0x100+cpu.sp, cpu.a);
-    if (cpu.sp>0) cpu.sp--;
-    else cpu.sp=0xFF;
+    writememory(cpu, 0x100+cpu->sp, cpu->a);
+    if (cpu->sp>0) cpu->sp--;
+    else cpu->sp=0xFF;
 }
 
-__attribute((always_inline)) inline void php (unsigned char mode) 
+__attribute((always_inline)) static inline void php (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"php ");
-#endif 
-    writememory(0x100+cpu.sp, cpu.status | 0x30);  // set bits break and reserved to true on the stack copy of the status register
-    if (cpu.sp>0) cpu.sp--;
-    else cpu.sp=0xFF;
+    writememory(cpu, 0x100+cpu->sp, getstatus(cpu) | 0x30);  // set bits break and reserved to true on the stack copy of the status register
+    if (cpu->sp>0) cpu->sp--;
+    else cpu->sp=0xFF;
 }
 
-__attribute((always_inline)) inline void pla (unsigned char mode) 
+__attribute((always_inline)) static inline void pla (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"pla ");
-#endif 
-    if (cpu.sp<0xFF) cpu.sp++;
-    else cpu.sp=0;
-    cpu.a = readmemory(0x100+cpu.sp);
+    if (cpu->sp<0xFF) cpu->sp++;
+    else cpu->sp=0;
+    cpu->a = readmemory(cpu, 0x100+cpu->sp);
 
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void plp (unsigned char mode) 
+__attribute((always_inline)) static inline void plp (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"plp ");
-#endif 
-    if (cpu.sp<0xFF) cpu.sp++;
-    else cpu.sp=0;
-    cpu.status = readmemory(0x100+cpu.sp) & 0xEF; //unset break flag
+    if (cpu->sp<0xFF) cpu->sp++;
+    else cpu->sp=0;
+    putstatus(cpu, readmemory(cpu, 0x100+cpu->sp) & 0xEF); //unset break flag
+    delayirq(cpu);
 }
 
-__attribute((always_inline)) inline void rol (unsigned char mode) 
+__attribute((always_inline)) static inline void rola (struct microprocessor *cpu) 
+{
+    cpu->a = rotateleft(cpu, cpu->a);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void rol (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned char tmp;
-    unsigned short aux;
     unsigned char val;
-#ifdef DEBUG
-    fprintf(stderr,"rol ");
-#endif 
-    if (mode==ACCUMULATOR)
-    {
-        tmp = cpu.status;
-        cpu.status = (cpu.status & ~(1UL << 0)) | ((cpu.a & (1UL << 7)) >> 7); // set bit carry on status processor to bit 7 of accumulator
-        cpu.a = cpu.a << 1;       
-        cpu.a = (cpu.a & ~(1UL << 0)) | (tmp & (1UL << 0)); // set bit zero on accumulator to previous carry
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-    }
-    else
-    {
-        aux = get_address(mode);
-        val = readmemory(aux);
-        tmp = cpu.status;
-        cpu.status = (cpu.status & ~(1UL << 0)) | ((val & (1UL << 7)) >> 7); // set bit carry on status processor to bit 7 of memory
-        val = val << 1;       
-        val = (val & ~(1UL << 0)) | (tmp & (1UL << 0)); // set bit zero on memory to previous carry
-        writememory(aux, val); 
-        if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor to true
-        if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
-    }
+    val = rotateleft(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val); 
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void ror (unsigned char mode) 
+__attribute((always_inline)) static inline void rora (struct microprocessor *cpu) 
+{
+    cpu->a = rotateright(cpu, cpu->a);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void ror (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned char tmp;
-    unsigned short aux;
     unsigned char val;
-#ifdef DEBUG
-    fprintf(stderr,"ror ");
-#endif 
-    if (mode==ACCUMULATOR)
-    {
-        tmp = cpu.status;
-        cpu.status = (cpu.status & ~(1UL << 0)) | (cpu.a & (1UL << 0)); // set bit carry on status processor to bit 0 of accumulator
-        cpu.a = cpu.a >> 1;       
-        cpu.a = (cpu.a & ~(1UL << 7)) | ((tmp & (1UL << 0)) << 7); // set bit 7 on accumulator to previous carry
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-    }
-    else
-    {
-        aux = get_address(mode);
-        val = readmemory(aux);
-        tmp = cpu.status;
-        cpu.status = (cpu.status & ~(1UL << 0)) | (val & (1UL << 0)); // set bit carry on status processor to bit 0 of memory
-        val = val >> 1;       
-        val = (val & ~(1UL << 7)) | ((tmp & (1UL << 0)) << 7); // set bit 7 on memory to previous carry
-        writememory(aux, val);
-        if (!val)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1); // set bit zero on status processor to true
-        if (val>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
-    }
+    val = rotateright(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void rti (unsigned char mode) 
+__attribute((always_inline)) static inline void rti (struct microprocessor *cpu) 
 {
     unsigned char operand_l, operand_h;
-#ifdef DEBUG
-    fprintf(stderr,"rti ");
-#endif
-    cpu.sp++;
-    cpu.status = readmemory(0x100+cpu.sp) & 0xCF; // clear bits 4 and 5 when restablishing the status register
-    cpu.sp++;
-    operand_l = readmemory(0x100+cpu.sp);
-    cpu.sp++;
-    operand_h = readmemory(0x100+cpu.sp);
-    cpu.pc = (unsigned short) ((operand_h<<8) | (operand_l));
+    cpu->sp++;
+    putstatus(cpu, readmemory(cpu, 0x100+cpu->sp) & 0xCF); // clear bits 4 and 5 when restablishing the status register
+    cpu->sp++;
+    operand_l = readmemory(cpu, 0x100+cpu->sp);
+    cpu->sp++;
+    operand_h = readmemory(cpu, 0x100+cpu->sp);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+    updateirq(cpu);
 }
 
-__attribute((always_inline)) inline void rts (unsigned char mode) 
+__attribute((always_inline)) static inline void rts (struct microprocessor *cpu) 
 {
     unsigned char operand_l, operand_h;
-#ifdef DEBUG
-    fprintf(stderr,"rts ");
-#endif 
-    cpu.sp++;
-    operand_l = readmemory(0x100+cpu.sp);
-    cpu.sp++;
-    operand_h = readmemory(0x100+cpu.sp);
-    cpu.pc = (unsigned short) ((operand_h<<8) | (operand_l)) + 1;
+    cpu->sp++;
+    operand_l = readmemory(cpu, 0x100+cpu->sp);
+    cpu->sp++;
+    operand_h = readmemory(cpu, 0x100+cpu->sp);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l)) + 1;
 }
 
-__attribute((always_inline)) inline void sbc (unsigned char mode) 
+__attribute((always_inline)) static inline void sbc (struct microprocessor *cpu, unsigned char operand) 
 {
     short sum; 
-    unsigned char operand;
-    unsigned char binsum;
-    int al;
-#ifdef DEBUG
-    fprintf(stderr,"sbc ");
-#endif 
-    if (mode==IMMEDIATE) operand = fetchmemory();
-    else operand = readmemory(get_address(mode));
-
     // 
     // If decimal flag is set, calculate decimal ADC
     //
-    if ((cpu.status & 1UL<<3)>>3) { 
-        if (cpu.status & 1UL<<0) {                      // If carry set
-            binsum = cpu.a + (operand^0xFFU) + 1; 
-            al = (cpu.a & 0x0F) - (operand & 0x0F);     
-        }
-        else {                                          // If carry clear
-            binsum = cpu.a + (operand^0xFFU);
-            al = (cpu.a & 0x0F) - (operand & 0x0F) - 1; 
-        }
-        if (al<0) al = ((al - 0x06) & 0x0F) - 0x10;
-        sum = (cpu.a & 0xF0) - (operand & 0xF0) + al;
-        if (sum<0) sum -= 0x60; 
-        if (sum>=0) cpu.status |= 1UL << 0;     // set bit carry on status processor 
-        else        cpu.status &= ~(1UL << 0);  // clear bit carry on status processor
-        if (!binsum)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (binsum>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-        if ((!((cpu.a ^ (operand^0xFFU)) & 0x80) && ((cpu.a ^ binsum) & 0x80))!=0) cpu.status |= 1UL << 6; else cpu.status &= ~(1UL << 6); // set bit overflow   
-        // printf ("%02X %02X %02X\n", cpu.a, operand, sum);
-        cpu.a = (char) sum;
+    if ((cpu->status & 1UL<<3)>>3) { 
+#ifdef DECIMALTABLE
+        decimal(cpu, 1, operand);
+#else
+        sbcdecimal(cpu, operand);
+#endif
     }
 
     // 
@@ -891,718 +919,3941 @@ __attribute((always_inline)) inline void sbc (unsigned char mode)
     //
     else {
         operand ^= 0xFFU;
-        if (cpu.status & 1UL<<0) sum = cpu.a + operand + 1; 
-        else                     sum = cpu.a + operand;
-        if (sum>0xFF) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);  // set bit carry on status processor
-        if ((!((cpu.a ^ operand) & 0x80) && ((cpu.a ^ sum) & 0x80))!=0) cpu.status |= 1UL << 6; else cpu.status &= ~(1UL << 6); // set bit overflow   
-        cpu.a = (char) sum; 
-        if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-        if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+        if (FLAGC) sum = cpu->a + operand + 1; 
+        else       sum = cpu->a + operand;
+        SETC(sum>0xFF);  // set bit carry on status processor
+        SETV(~(cpu->a ^ operand) & (cpu->a ^ sum) & 0x80); // set bit overflow   
+        cpu->a = (char) sum; 
+        SETNZ(cpu->a);                  // set bits zero and negative on status processor
     }
 
 }
 
-__attribute((always_inline)) inline void sec (unsigned char mode)
+__attribute((always_inline)) static inline void sec (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"sec ");
-#endif 
-    cpu.status |= 1UL << 0;     // set bit carry on status processor to true
+    SETC(1);                     // set bit carry on status processor to true
 }
 
-__attribute((always_inline)) inline void sed (unsigned char mode)
+__attribute((always_inline)) static inline void sed (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"sed ");
-#endif 
-    cpu.status |= 1UL << 3;     // set bit decimal on status processor to true
+    cpu->status |= 1UL << 3;     // set bit decimal on status processor to true
 }
 
-__attribute((always_inline)) inline void sei (unsigned char mode)
+__attribute((always_inline)) static inline void sei (struct microprocessor *cpu)
 {
-#ifdef DEBUG
-    fprintf(stderr,"sei ");
-#endif 
-    cpu.status |= 1UL << 2;     // set bit interrupt on status processor to true (interrupt disabled)
+    cpu->status |= 1UL << 2;     // set bit interrupt on status processor to true (interrupt disabled)
 }
 
-__attribute((always_inline)) inline void sta (unsigned char mode) 
+__attribute((always_inline)) static inline void sta (struct microprocessor *cpu, unsigned short address) 
 {
-    int addr;
-#ifdef DEBUG
-    fprintf(stderr,"sta ");
-#endif 
-    addr = get_address(mode);
-	writememory(addr, cpu.a);
+	writememory(cpu, address, cpu->a);
 }
 
-__attribute((always_inline)) inline void stx (unsigned char mode) 
+__attribute((always_inline)) static inline void stx (struct microprocessor *cpu, unsigned short address) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"stx ");
-#endif 
-	writememory(get_address(mode), cpu.x);
+	writememory(cpu, address, cpu->x);
 }
 
-__attribute((always_inline)) inline void sty (unsigned char mode) 
+__attribute((always_inline)) static inline void sty (struct microprocessor *cpu, unsigned short address) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"sty ");
-#endif 
-	writememory(get_address(mode), cpu.y);
+	writememory(cpu, address, cpu->y);
 }
 
-__attribute((always_inline)) inline void tax (unsigned char mode) 
+__attribute((always_inline)) static inline void tax (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"tax ");
-#endif 
-    cpu.x = cpu.a;
-    if (!cpu.x)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.x>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->x = cpu->a;
+    SETNZ(cpu->x);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void tay (unsigned char mode) 
+__attribute((always_inline)) static inline void tay (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"tay ");
-#endif 
-    cpu.y = cpu.a;
-    if (!cpu.y)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.y>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->y = cpu->a;
+    SETNZ(cpu->y);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void tsx (unsigned char mode) 
+__attribute((always_inline)) static inline void tsx (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"tsx ");
-#endif 
-    cpu.x = cpu.sp;
-    if (!cpu.x)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.x>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->x = cpu->sp;
+    SETNZ(cpu->x);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void txa (unsigned char mode) 
+__attribute((always_inline)) static inline void txa (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"txa ");
-#endif 
-    cpu.a = cpu.x;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->a = cpu->x;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void txs (unsigned char mode) 
+__attribute((always_inline)) static inline void txs (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"txs ");
-#endif 
-    cpu.sp = cpu.x;
+    cpu->sp = cpu->x;
 }
 
-__attribute((always_inline)) inline void tya (unsigned char mode) 
+__attribute((always_inline)) static inline void tya (struct microprocessor *cpu) 
 {
-#ifdef DEBUG
-    fprintf(stderr,"tya ");
-#endif 
-    cpu.a = cpu.y;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->a = cpu->y;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
 //
 // Undocumented opcodes are required for better emulation of older software
 //
 
-__attribute((always_inline)) inline void anc (unsigned char mode) {
-    printf ("ANC opcode detected\n");
-    cpu.a &= fetchmemory();
-    if (cpu.a>=0x80) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);  // set bit carry on status processor
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+__attribute((always_inline)) static inline void anc (struct microprocessor *cpu, unsigned char value) {
+    cpu->a &= value;
+    SETC(cpu->a>=0x80);  // set bit carry on status processor
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void sax (unsigned char mode) {
-    printf ("SAX opcode detected\n");
-    writememory(get_address(mode),  cpu.a & cpu.x );
+__attribute((always_inline)) static inline void sax (struct microprocessor *cpu, unsigned short address) {
+    writememory(cpu, address,  cpu->a & cpu->x );
 }
 
-__attribute((always_inline)) inline void lax (unsigned char mode) {
-#ifdef DEBUG
-    fprintf(stderr,"lax ");
-#endif 
-    printf ("LAX opcode detected\n");
-    if (mode==IMMEDIATE) {
-        cpu.a &= fetchmemory();
-        cpu.x = cpu.a;
-    }
-    else 
-    {
-        cpu.a = readmemory(get_address(mode));
-        cpu.x = cpu.a;
-    }
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+__attribute((always_inline)) static inline void lax (struct microprocessor *cpu, unsigned char value) {
+    cpu->a = value;
+    cpu->x = cpu->a;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+//
+// Immediate version of lax (also known as lxa), ands the operand with the 
+// accumulator
+//
+__attribute((always_inline)) static inline void lxa (struct microprocessor *cpu, unsigned char value) {
+    cpu->a &= value;
+    cpu->x = cpu->a;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void sre (unsigned char mode)
+__attribute((always_inline)) static inline void sre (struct microprocessor *cpu, unsigned short addr)
 {
-    int addr;
     unsigned char value;
-    printf ("SRE opcode detected\n");
-    value = readmemory(addr = get_address(mode));
-    cpu.status = (cpu.status & ~(1UL << 0)) | (value & 1UL << 0); // set bit carry on status processor to value in memory bit zero
-    writememory(addr, value>>1);
-    cpu.a ^= value;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    value = readmemory(cpu, addr);
+    writememory(cpu, addr, shiftright(cpu, value));
+    cpu->a ^= value;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void slo (unsigned char mode) 
+__attribute((always_inline)) static inline void slo (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned short aux;
-    unsigned short val;
-    printf ("SLO opcode detected\n");
-    aux = get_address(mode);
-    val = readmemory(aux);
-    if (val>=0x80) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0); // set bit carry on status processor to true
-//    val &= ~(1UL << 7);                                                    // set bit 7 of input to 0
-    val = val << 1;
-    writememory ( aux, val );
-    cpu.a |= val;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    unsigned char val;
+    val = shiftleft(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val );
+    cpu->a |= val;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void rla (unsigned char mode) 
+__attribute((always_inline)) static inline void rla (struct microprocessor *cpu, unsigned short aux) 
 {
-    unsigned char tmp;
-    unsigned short aux;
     unsigned char val;
-    printf ("RLA opcode detected\n");
-    aux = get_address(mode);
-    val = readmemory(aux);
-    tmp = cpu.status;
-    cpu.status = (cpu.status & ~(1UL << 0)) | ((val & (1UL << 7)) >> 7); // set bit carry on status processor to bit 7 of memory
-    val = val << 1;       
-    val = (val & ~(1UL << 0)) | (tmp & (1UL << 0)); // set bit zero on memory to previous carry
-    writememory(aux, val); 
-    cpu.a &= val;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    val = rotateleft(cpu, readmemory(cpu, aux));
+    writememory(cpu, aux, val); 
+    cpu->a &= val;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
-__attribute((always_inline)) inline void dcp (unsigned char mode) {
+__attribute((always_inline)) static inline void dcp (struct microprocessor *cpu, unsigned short address) {
     unsigned char tmp;
-    unsigned short address;
-    printf ("DCP opcode detected\n");
-    tmp = readmemory(address=get_address(mode));
+    tmp = readmemory(cpu, address);
     tmp--;
-    writememory(address, tmp);
-    if (cpu.a >= tmp) cpu.status |= 1UL << 0; else cpu.status &= ~(1UL << 0);               // set bit carry on status processor to true
-    if (cpu.a == tmp) cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);               // set bit zero on status processor to true
-    if ((cpu.a - tmp) & (1UL << 7)) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7); // set bit negative on status processor to true
-}
-
-__attribute((always_inline)) inline void alr (unsigned char mode) {
-    printf ("ALR opcode detected\n");
-    cpu.a &= fetchmemory(); 
-    cpu.status = (cpu.status & ~(1UL << 0)) | (cpu.a & 1UL << 0); // set bit carry on status processor to accumulator bit zero
-    cpu.a = cpu.a >> 1;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-}
-
-__attribute((always_inline)) inline void las (unsigned char mode) {
-    printf ("LAS opcode detected\n");
-    cpu.a = readmemory(get_address(mode)) & cpu.status;
-    cpu.x = cpu.a;
-    cpu.status = cpu.a;
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
-}
-
-__attribute((always_inline)) inline void arr (unsigned char mode) {
-    unsigned char operand, aux; 
-    printf ("ARR opcode detected\n");
-    operand = fetchmemory();
-    cpu.a &= operand;
-    aux = cpu.status >> 7;
+    writememory(cpu, address, tmp);
+    SETC(cpu->a >= tmp);               // set bit carry on status processor to true
+    SETNZ(cpu->a - tmp);               // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void alr (struct microprocessor *cpu, unsigned char value) {
+    cpu->a &= value; 
+    SETC(cpu->a & 1UL << 0); // set bit carry on status processor to accumulator bit zero
+    cpu->a = cpu->a >> 1;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void las (struct microprocessor *cpu, unsigned char value) {
+    cpu->a = value & getstatus(cpu);
+    cpu->x = cpu->a;
+    putstatus(cpu, cpu->a);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+    delayirq(cpu);                  // may clear the interrupt flag, as plp
+}
+
+__attribute((always_inline)) static inline void arr (struct microprocessor *cpu, unsigned char operand) {
+    unsigned char aux; 
+    cpu->a &= operand;
+    aux = FLAGN ? 1 : 0;
     switch (aux) {
         case 0x00 : 
-            cpu.status &= ~(1UL << 0);
-            cpu.status &= ~(1UL << 6);
+            SETC(0);
+            SETV(0);
             break;
         case 0x01 : 
-            cpu.status &= ~(1UL << 0);
-            cpu.status |= 1UL << 6;
+            SETC(0);
+            SETV(1);
             break;
         case 0x10 : 
-            cpu.status |= 1UL << 0;
-            cpu.status |= 1UL << 6;
+            SETC(1);
+            SETV(1);
             break;
         case 0x11 : 
-            cpu.status |= 1UL << 0;
-            cpu.status &= ~(1UL << 6);
+            SETC(1);
+            SETV(0);
             break;
     }
-    cpu.a = (cpu.a >> 1);
-    if (!cpu.a)      cpu.status |= 1UL << 1; else cpu.status &= ~(1UL << 1);  // set bit zero on status processor 
-    if (cpu.a>=0x80) cpu.status |= 1UL << 7; else cpu.status &= ~(1UL << 7);  // set bit negative on status processor
+    cpu->a = (cpu->a >> 1);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
 }
 
 
-__attribute((always_inline)) inline void sbx (unsigned char mode) {
-    printf ("SBX opcode detected (not yet implemented)\n");
-    fetchmemory();
+__attribute((always_inline)) static inline void sbx (struct microprocessor *cpu, unsigned char value) {
+    // not yet implemented, runs as a nop
 }
 
-__attribute((always_inline)) inline void sha (unsigned char mode) {
-    unsigned short address; 
+__attribute((always_inline)) static inline void sha (struct microprocessor *cpu, unsigned short address) {
     unsigned char operand_high;
-    printf ("SHA opcode detected\n");
-    address = get_address(mode); 
     operand_high = (unsigned char) (((address & 0xFF00)>>8)+1);
-    writememory (address, cpu.a & cpu.x & operand_high);
+    writememory(cpu, address, cpu->a & cpu->x & operand_high);
 }    
     
-__attribute((always_inline)) inline void shx (unsigned char mode) {
-    unsigned short address; 
+__attribute((always_inline)) static inline void shx (struct microprocessor *cpu, unsigned short address) {
     unsigned char operand_high;
-    printf ("SHX opcode detected\n");
-    address = get_address(mode); 
     operand_high = (unsigned char) (((address & 0xFF00)>>8)+1);
-    writememory (address, cpu.x & operand_high);
+    writememory(cpu, address, cpu->x & operand_high);
 }
 
-__attribute((always_inline)) inline void shy (unsigned char mode) {
-    unsigned short address; 
+__attribute((always_inline)) static inline void shy (struct microprocessor *cpu, unsigned short address) {
     unsigned char operand_high;
-    printf ("SHY opcode detected\n");
-    address = get_address(mode); 
     operand_high = (unsigned char) (((address & 0xFF00)>>8)+1);
-    writememory (address, cpu.y & operand_high);
+    writememory(cpu, address, cpu->y & operand_high);
 }
 
-__attribute((always_inline)) inline void tas (unsigned char mode) {
-    unsigned short address; 
+__attribute((always_inline)) static inline void tas (struct microprocessor *cpu, unsigned short address) {
     unsigned char operand_high;
-    printf ("TAS opcode detected\n");
-    address = get_address(mode); 
     operand_high = (unsigned char) (((address & 0xFF00)>>8)+1);
-    cpu.sp = cpu.x & cpu.a;
-    writememory (address, cpu.sp & operand_high);
+    cpu->sp = cpu->x & cpu->a;
+    writememory(cpu, address, cpu->sp & operand_high);
 }
 
-__attribute((always_inline)) inline void ane (unsigned char mode) {
-    printf ("ANE opcode detected (unstable, not implemented)\n");
-    fetchmemory();
+__attribute((always_inline)) static inline void ane (struct microprocessor *cpu, unsigned char value) {
+    // unstable, not implemented, runs as a nop
 }
 
 /*
-__attribute((always_inline)) inline void rra (unsigned char mode)
-__attribute((always_inline)) inline void isc (unsigned char mode)
+__attribute((always_inline)) static inline void rra (struct microprocessor *cpu, unsigned short address)
+__attribute((always_inline)) static inline void isc (struct microprocessor *cpu, unsigned short address)
 */
 
 
-// 
-// Switch case to execute CPU command based on opcode
 //
-int processcommand()
-{ 
-                                //     0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-    const unsigned char length[256]= { 7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,  // 00
-                                       2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 10
-                                       6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,  // 20
-                                       2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 30
-                                       6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,  // 40
-                                       2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 50
-                                       6, 6, 2, 2, 3, 3, 5, 2, 4, 2, 2, 2, 5, 4, 6, 2,  // 60
-                                       2, 5, 2, 2, 4, 4, 6, 2, 2, 4, 2, 2, 4, 4, 7, 2,  // 70
-                                       2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  // 80
-                                       2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,  // 90
-                                       2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  // A0
-                                       2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,  // B0
-                                       2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,  // C0
-                                       2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // D0
-                                       2, 6, 2, 2, 3, 3, 5, 2, 2, 2, 2, 2, 4, 4, 6, 2,  // E0
-                                       2, 5, 2, 2, 4, 4, 6, 2, 2, 4, 2, 2, 4, 4, 7, 2 };// F0
-    unsigned char command;
+// Mnemonics of the opcodes, in alphabetical order. The undocumented ones use
+// the names of the "NMOS 6510 Unintended Opcodes" document.
+//
+#define NAME_ADC 0
+#define NAME_ALR 1
+#define NAME_ANC 2
+#define NAME_AND 3
+#define NAME_ANE 4
+#define NAME_ARR 5
+#define NAME_ASL 6
+#define NAME_BCC 7
+#define NAME_BCS 8
+#define NAME_BEQ 9
+#define NAME_BIT 10
+#define NAME_BMI 11
+#define NAME_BNE 12
+#define NAME_BPL 13
+#define NAME_BRK 14
+#define NAME_BVC 15
+#define NAME_BVS 16
+#define NAME_CLC 17
+#define NAME_CLD 18
+#define NAME_CLI 19
+#define NAME_CLV 20
+#define NAME_CMP 21
+#define NAME_CPX 22
+#define NAME_CPY 23
+#define NAME_DCP 24
+#define NAME_DEC 25
+#define NAME_DEX 26
+#define NAME_DEY 27
+#define NAME_EOR 28
+#define NAME_INC 29
+#define NAME_INX 30
+#define NAME_INY 31
+#define NAME_ISC 32
+#define NAME_JAM 33
+#define NAME_JMP 34
+#define NAME_JSR 35
+#define NAME_LAS 36
+#define NAME_LAX 37
+#define NAME_LDA 38
+#define NAME_LDX 39
+#define NAME_LDY 40
+#define NAME_LSR 41
+#define NAME_LXA 42
+#define NAME_NOP 43
+#define NAME_ORA 44
+#define NAME_PHA 45
+#define NAME_PHP 46
+#define NAME_PLA 47
+#define NAME_PLP 48
+#define NAME_RLA 49
+#define NAME_ROL 50
+#define NAME_ROR 51
+#define NAME_RRA 52
+#define NAME_RTI 53
+#define NAME_RTS 54
+#define NAME_SAX 55
+#define NAME_SBC 56
+#define NAME_SBX 57
+#define NAME_SEC 58
+#define NAME_SED 59
+#define NAME_SEI 60
+#define NAME_SHA 61
+#define NAME_SHX 62
+#define NAME_SHY 63
+#define NAME_SLO 64
+#define NAME_SRE 65
+#define NAME_STA 66
+#define NAME_STX 67
+#define NAME_STY 68
+#define NAME_TAS 69
+#define NAME_TAX 70
+#define NAME_TAY 71
+#define NAME_TSX 72
+#define NAME_TXA 73
+#define NAME_TXS 74
+#define NAME_TYA 75
+
+const char opcodenames[][4] = {
+    "adc", "alr", "anc", "and", "ane", "arr", "asl", "bcc", "bcs", "beq", "bit", "bmi", "bne", "bpl", "brk", "bvc",
+    "bvs", "clc", "cld", "cli", "clv", "cmp", "cpx", "cpy", "dcp", "dec", "dex", "dey", "eor", "inc", "inx", "iny",
+    "isc", "jam", "jmp", "jsr", "las", "lax", "lda", "ldx", "ldy", "lsr", "lxa", "nop", "ora", "pha", "php", "pla",
+    "plp", "rla", "rol", "ror", "rra", "rti", "rts", "sax", "sbc", "sbx", "sec", "sed", "sei", "sha", "shx", "shy",
+    "slo", "sre", "sta", "stx", "sty", "tas", "tax", "tay", "tsx", "txa", "txs", "tya" };
 
-    bordercross = 0;
-    command = fetchmemory();
-    cpu.cycles += length[command];
+//
+// The opcode table (see 6502.h). The cycles are the base cycles, the branches
+// add their own penalty and the engines add the page crossing penalty after
+// each opcode with OPCODE_PENALTY (see pagepenalty). The size is the number
+// of bytes read by the body of the opcode in opcodes.h, the opcodes not
+// implemented read no operand. The flags match the diagnostic reported by
+// the body, the undocumented sbc (EB) reports none.
+//
+#define OP(name, mode, cycles, size, flags) { NAME_##name, MODE_##mode, cycles, size | (flags) }
+
+const struct opcodeinfo opcodeinfo[256] = {
+    OP(BRK, IMP, 7, 1, 0),                                        // 00
+    OP(ORA, IZX, 6, 2, 0),                                        // 01
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 02
+    OP(SLO, IZX, 8, 2, OPCODE_UNDOCUMENTED),                      // 03
+    OP(NOP, ZP , 3, 2, OPCODE_UNDOCUMENTED),                      // 04
+    OP(ORA, ZP , 3, 2, 0),                                        // 05
+    OP(ASL, ZP , 5, 2, 0),                                        // 06
+    OP(SLO, ZP , 5, 2, OPCODE_UNDOCUMENTED),                      // 07
+    OP(PHP, IMP, 3, 1, 0),                                        // 08
+    OP(ORA, IMM, 2, 2, 0),                                        // 09
+    OP(ASL, IMP, 2, 1, 0),                                        // 0A
+    OP(ANC, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 0B
+    OP(NOP, ABS, 4, 3, OPCODE_UNDOCUMENTED),                      // 0C
+    OP(ORA, ABS, 4, 3, 0),                                        // 0D
+    OP(ASL, ABS, 6, 3, 0),                                        // 0E
+    OP(SLO, ABS, 6, 3, OPCODE_UNDOCUMENTED),                      // 0F
+    OP(BPL, REL, 2, 2, 0),                                        // 10
+    OP(ORA, IZY, 5, 2, OPCODE_PENALTY),                           // 11
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 12
+    OP(SLO, IZY, 8, 2, OPCODE_UNDOCUMENTED),                      // 13
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // 14
+    OP(ORA, ZPX, 4, 2, 0),                                        // 15
+    OP(ASL, ZPX, 6, 2, 0),                                        // 16
+    OP(SLO, ZPX, 6, 2, OPCODE_UNDOCUMENTED),                      // 17
+    OP(CLC, IMP, 2, 1, 0),                                        // 18
+    OP(ORA, ABY, 4, 3, OPCODE_PENALTY),                           // 19
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // 1A
+    OP(SLO, ABY, 7, 3, OPCODE_UNDOCUMENTED),                      // 1B
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // 1C
+    OP(ORA, ABX, 4, 3, OPCODE_PENALTY),                           // 1D
+    OP(ASL, ABX, 7, 3, 0),                                        // 1E
+    OP(SLO, ABX, 7, 3, OPCODE_UNDOCUMENTED),                      // 1F
+    OP(JSR, ABS, 6, 3, 0),                                        // 20
+    OP(AND, IZX, 6, 2, 0),                                        // 21
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 22
+    OP(RLA, IZX, 8, 2, OPCODE_UNDOCUMENTED),                      // 23
+    OP(BIT, ZP , 3, 2, 0),                                        // 24
+    OP(AND, ZP , 3, 2, 0),                                        // 25
+    OP(ROL, ZP , 5, 2, 0),                                        // 26
+    OP(RLA, ZP , 5, 2, OPCODE_UNDOCUMENTED),                      // 27
+    OP(PLP, IMP, 4, 1, 0),                                        // 28
+    OP(AND, IMM, 2, 2, 0),                                        // 29
+    OP(ROL, IMP, 2, 1, 0),                                        // 2A
+    OP(ANC, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 2B
+    OP(BIT, ABS, 4, 3, 0),                                        // 2C
+    OP(AND, ABS, 4, 3, 0),                                        // 2D
+    OP(ROL, ABS, 6, 3, 0),                                        // 2E
+    OP(RLA, ABS, 6, 3, OPCODE_UNDOCUMENTED),                      // 2F
+    OP(BMI, REL, 2, 2, 0),                                        // 30
+    OP(AND, IZY, 5, 2, OPCODE_PENALTY),                           // 31
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 32
+    OP(RLA, IZY, 8, 2, OPCODE_UNDOCUMENTED),                      // 33
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // 34
+    OP(AND, ZPX, 4, 2, 0),                                        // 35
+    OP(ROL, ZPX, 6, 2, 0),                                        // 36
+    OP(RLA, ZPX, 6, 2, OPCODE_UNDOCUMENTED),                      // 37
+    OP(SEC, IMP, 2, 1, 0),                                        // 38
+    OP(AND, ABY, 4, 3, OPCODE_PENALTY),                           // 39
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // 3A
+    OP(RLA, ABY, 7, 3, OPCODE_UNDOCUMENTED),                      // 3B
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // 3C
+    OP(AND, ABX, 4, 3, OPCODE_PENALTY),                           // 3D
+    OP(ROL, ABX, 7, 3, 0),                                        // 3E
+    OP(RLA, ABX, 7, 3, OPCODE_UNDOCUMENTED),                      // 3F
+    OP(RTI, IMP, 6, 1, 0),                                        // 40
+    OP(EOR, IZX, 6, 2, 0),                                        // 41
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 42
+    OP(SRE, IZX, 8, 2, OPCODE_UNDOCUMENTED),                      // 43
+    OP(NOP, ZP , 3, 2, OPCODE_UNDOCUMENTED),                      // 44
+    OP(EOR, ZP , 3, 2, 0),                                        // 45
+    OP(LSR, ZP , 5, 2, 0),                                        // 46
+    OP(SRE, ZP , 5, 2, OPCODE_UNDOCUMENTED),                      // 47
+    OP(PHA, IMP, 3, 1, 0),                                        // 48
+    OP(EOR, IMM, 2, 2, 0),                                        // 49
+    OP(LSR, IMP, 2, 1, 0),                                        // 4A
+    OP(ALR, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 4B
+    OP(JMP, ABS, 3, 3, 0),                                        // 4C
+    OP(EOR, ABS, 4, 3, 0),                                        // 4D
+    OP(LSR, ABS, 6, 3, 0),                                        // 4E
+    OP(SRE, ABS, 6, 3, OPCODE_UNDOCUMENTED),                      // 4F
+    OP(BVC, REL, 2, 2, 0),                                        // 50
+    OP(EOR, IZY, 5, 2, OPCODE_PENALTY),                           // 51
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 52
+    OP(SRE, IZY, 8, 2, OPCODE_UNDOCUMENTED),                      // 53
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // 54
+    OP(EOR, ZPX, 4, 2, 0),                                        // 55
+    OP(LSR, ZPX, 6, 2, 0),                                        // 56
+    OP(SRE, ZPX, 6, 2, OPCODE_UNDOCUMENTED),                      // 57
+    OP(CLI, IMP, 2, 1, 0),                                        // 58
+    OP(EOR, ABY, 4, 3, OPCODE_PENALTY),                           // 59
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // 5A
+    OP(SRE, ABY, 7, 3, OPCODE_UNDOCUMENTED),                      // 5B
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // 5C
+    OP(EOR, ABX, 4, 3, OPCODE_PENALTY),                           // 5D
+    OP(LSR, ABX, 7, 3, 0),                                        // 5E
+    OP(SRE, ABX, 7, 3, OPCODE_UNDOCUMENTED),                      // 5F
+    OP(RTS, IMP, 6, 1, 0),                                        // 60
+    OP(ADC, IZX, 6, 2, 0),                                        // 61
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 62
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 63
+    OP(NOP, ZP , 3, 2, OPCODE_UNDOCUMENTED),                      // 64
+    OP(ADC, ZP , 3, 2, 0),                                        // 65
+    OP(ROR, ZP , 5, 2, 0),                                        // 66
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 67
+    OP(PLA, IMP, 4, 1, 0),                                        // 68
+    OP(ADC, IMM, 2, 2, 0),                                        // 69
+    OP(ROR, IMP, 2, 1, 0),                                        // 6A
+    OP(ARR, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 6B
+    OP(JMP, IND, 5, 3, 0),                                        // 6C
+    OP(ADC, ABS, 4, 3, 0),                                        // 6D
+    OP(ROR, ABS, 6, 3, 0),                                        // 6E
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 6F
+    OP(BVS, REL, 2, 2, 0),                                        // 70
+    OP(ADC, IZY, 5, 2, OPCODE_PENALTY),                           // 71
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 72
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 73
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // 74
+    OP(ADC, ZPX, 4, 2, 0),                                        // 75
+    OP(ROR, ZPX, 6, 2, 0),                                        // 76
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 77
+    OP(SEI, IMP, 2, 1, 0),                                        // 78
+    OP(ADC, ABY, 4, 3, OPCODE_PENALTY),                           // 79
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // 7A
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 7B
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // 7C
+    OP(ADC, ABX, 4, 3, OPCODE_PENALTY),                           // 7D
+    OP(ROR, ABX, 7, 3, 0),                                        // 7E
+    OP(RRA, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 7F
+    OP(NOP, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 80
+    OP(STA, IZX, 6, 2, 0),                                        // 81
+    OP(NOP, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 82
+    OP(SAX, IZX, 6, 2, OPCODE_UNDOCUMENTED),                      // 83
+    OP(STY, ZP , 3, 2, 0),                                        // 84
+    OP(STA, ZP , 3, 2, 0),                                        // 85
+    OP(STX, ZP , 3, 2, 0),                                        // 86
+    OP(SAX, ZP , 3, 2, OPCODE_UNDOCUMENTED),                      // 87
+    OP(DEY, IMP, 2, 1, 0),                                        // 88
+    OP(NOP, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // 89
+    OP(TXA, IMP, 2, 1, 0),                                        // 8A
+    OP(ANE, IMM, 2, 2, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// 8B
+    OP(STY, ABS, 4, 3, 0),                                        // 8C
+    OP(STA, ABS, 4, 3, 0),                                        // 8D
+    OP(STX, ABS, 4, 3, 0),                                        // 8E
+    OP(SAX, ABS, 4, 3, OPCODE_UNDOCUMENTED),                      // 8F
+    OP(BCC, REL, 2, 2, 0),                                        // 90
+    OP(STA, IZY, 6, 2, 0),                                        // 91
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // 92
+    OP(SHA, IZY, 6, 2, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // 93
+    OP(STY, ZPX, 4, 2, 0),                                        // 94
+    OP(STA, ZPX, 4, 2, 0),                                        // 95
+    OP(STX, ZPY, 4, 2, 0),                                        // 96
+    OP(SAX, ZPY, 4, 2, OPCODE_UNDOCUMENTED),                      // 97
+    OP(TYA, IMP, 2, 1, 0),                                        // 98
+    OP(STA, ABY, 5, 3, 0),                                        // 99
+    OP(TXS, IMP, 2, 1, 0),                                        // 9A
+    OP(TAS, ABY, 5, 3, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // 9B
+    OP(SHY, ABX, 5, 3, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // 9C
+    OP(STA, ABX, 5, 3, 0),                                        // 9D
+    OP(SHX, ABY, 5, 3, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // 9E
+    OP(SHA, ABY, 5, 3, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // 9F
+    OP(LDY, IMM, 2, 2, 0),                                        // A0
+    OP(LDA, IZX, 6, 2, 0),                                        // A1
+    OP(LDX, IMM, 2, 2, 0),                                        // A2
+    OP(LAX, IZX, 6, 2, OPCODE_UNDOCUMENTED),                      // A3
+    OP(LDY, ZP , 3, 2, 0),                                        // A4
+    OP(LDA, ZP , 3, 2, 0),                                        // A5
+    OP(LDX, ZP , 3, 2, 0),                                        // A6
+    OP(LAX, ZP , 3, 2, OPCODE_UNDOCUMENTED),                      // A7
+    OP(TAY, IMP, 2, 1, 0),                                        // A8
+    OP(LDA, IMM, 2, 2, 0),                                        // A9
+    OP(TAX, IMP, 2, 1, 0),                                        // AA
+    OP(LXA, IMM, 2, 2, OPCODE_UNDOCUMENTED | OPCODE_UNSTABLE),    // AB
+    OP(LDY, ABS, 4, 3, 0),                                        // AC
+    OP(LDA, ABS, 4, 3, 0),                                        // AD
+    OP(LDX, ABS, 4, 3, 0),                                        // AE
+    OP(LAX, ABS, 4, 3, OPCODE_UNDOCUMENTED),                      // AF
+    OP(BCS, REL, 2, 2, 0),                                        // B0
+    OP(LDA, IZY, 5, 2, OPCODE_PENALTY),                           // B1
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // B2
+    OP(LAX, IZY, 5, 2, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // B3
+    OP(LDY, ZPX, 4, 2, 0),                                        // B4
+    OP(LDA, ZPX, 4, 2, 0),                                        // B5
+    OP(LDX, ZPY, 4, 2, 0),                                        // B6
+    OP(LAX, ZPY, 4, 2, OPCODE_UNDOCUMENTED),                      // B7
+    OP(CLV, IMP, 2, 1, 0),                                        // B8
+    OP(LDA, ABY, 4, 3, OPCODE_PENALTY),                           // B9
+    OP(TSX, IMP, 2, 1, 0),                                        // BA
+    OP(LAS, ABY, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // BB
+    OP(LDY, ABX, 4, 3, OPCODE_PENALTY),                           // BC
+    OP(LDA, ABX, 4, 3, OPCODE_PENALTY),                           // BD
+    OP(LDX, ABY, 4, 3, OPCODE_PENALTY),                           // BE
+    OP(LAX, ABY, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // BF
+    OP(CPY, IMM, 2, 2, 0),                                        // C0
+    OP(CMP, IZX, 6, 2, 0),                                        // C1
+    OP(NOP, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // C2
+    OP(DCP, IZX, 8, 2, OPCODE_UNDOCUMENTED),                      // C3
+    OP(CPY, ZP , 3, 2, 0),                                        // C4
+    OP(CMP, ZP , 3, 2, 0),                                        // C5
+    OP(DEC, ZP , 5, 2, 0),                                        // C6
+    OP(DCP, ZP , 5, 2, OPCODE_UNDOCUMENTED),                      // C7
+    OP(INY, IMP, 2, 1, 0),                                        // C8
+    OP(CMP, IMM, 2, 2, 0),                                        // C9
+    OP(DEX, IMP, 2, 1, 0),                                        // CA
+    OP(SBX, IMM, 2, 2, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// CB
+    OP(CPY, ABS, 4, 3, 0),                                        // CC
+    OP(CMP, ABS, 4, 3, 0),                                        // CD
+    OP(DEC, ABS, 6, 3, 0),                                        // CE
+    OP(DCP, ABS, 6, 3, OPCODE_UNDOCUMENTED),                      // CF
+    OP(BNE, REL, 2, 2, 0),                                        // D0
+    OP(CMP, IZY, 5, 2, OPCODE_PENALTY),                           // D1
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // D2
+    OP(DCP, IZY, 8, 2, OPCODE_UNDOCUMENTED),                      // D3
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // D4
+    OP(CMP, ZPX, 4, 2, 0),                                        // D5
+    OP(DEC, ZPX, 6, 2, 0),                                        // D6
+    OP(DCP, ZPX, 6, 2, OPCODE_UNDOCUMENTED),                      // D7
+    OP(CLD, IMP, 2, 1, 0),                                        // D8
+    OP(CMP, ABY, 4, 3, OPCODE_PENALTY),                           // D9
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // DA
+    OP(DCP, ABY, 7, 3, OPCODE_UNDOCUMENTED),                      // DB
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // DC
+    OP(CMP, ABX, 4, 3, OPCODE_PENALTY),                           // DD
+    OP(DEC, ABX, 7, 3, 0),                                        // DE
+    OP(DCP, ABX, 7, 3, OPCODE_UNDOCUMENTED),                      // DF
+    OP(CPX, IMM, 2, 2, 0),                                        // E0
+    OP(SBC, IZX, 6, 2, 0),                                        // E1
+    OP(NOP, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // E2
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// E3
+    OP(CPX, ZP , 3, 2, 0),                                        // E4
+    OP(SBC, ZP , 3, 2, 0),                                        // E5
+    OP(INC, ZP , 5, 2, 0),                                        // E6
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// E7
+    OP(INX, IMP, 2, 1, 0),                                        // E8
+    OP(SBC, IMM, 2, 2, 0),                                        // E9
+    OP(NOP, IMP, 2, 1, 0),                                        // EA
+    OP(SBC, IMM, 2, 2, OPCODE_UNDOCUMENTED),                      // EB
+    OP(CPX, ABS, 4, 3, 0),                                        // EC
+    OP(SBC, ABS, 4, 3, 0),                                        // ED
+    OP(INC, ABS, 6, 3, 0),                                        // EE
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// EF
+    OP(BEQ, REL, 2, 2, 0),                                        // F0
+    OP(SBC, IZY, 5, 2, OPCODE_PENALTY),                           // F1
+    OP(JAM, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_JAM),         // F2
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// F3
+    OP(NOP, ZPX, 4, 2, OPCODE_UNDOCUMENTED),                      // F4
+    OP(SBC, ZPX, 4, 2, 0),                                        // F5
+    OP(INC, ZPX, 6, 2, 0),                                        // F6
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// F7
+    OP(SED, IMP, 2, 1, 0),                                        // F8
+    OP(SBC, ABY, 4, 3, OPCODE_PENALTY),                           // F9
+    OP(NOP, IMP, 2, 1, OPCODE_UNDOCUMENTED),                      // FA
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// FB
+    OP(NOP, ABX, 4, 3, OPCODE_UNDOCUMENTED | OPCODE_PENALTY),     // FC
+    OP(SBC, ABX, 4, 3, OPCODE_PENALTY),                           // FD
+    OP(INC, ABX, 7, 3, 0),                                        // FE
+    OP(ISC, IMP, 2, 1, OPCODE_UNDOCUMENTED | OPCODE_UNIMPLEMENTED),// FF
+};
+
+#undef OP
 
-#ifdef DEBUG
-    fprintf (stderr, "%2X ", command);
-#endif 
-    
-    switch (command)
-    {
-        case 0x69: adc(IMMEDIATE); break;
-        case 0x65: adc(ZERO_PAGE); break;
-        case 0x75: adc(ZERO_PAGE_X); break;
-        case 0x6D: adc(ABSOLUTE); break;
-        case 0x7D: adc(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0x79: adc(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0x61: adc(INDIRECT_X); break;
-        case 0x71: adc(INDIRECT_Y); cpu.cycles += bordercross; break;
-
-        case 0x29: fand(IMMEDIATE); break;
-        case 0x25: fand(ZERO_PAGE); break;
-        case 0x35: fand(ZERO_PAGE_X); break;
-        case 0x2D: fand(ABSOLUTE); break;
-        case 0x3D: fand(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0x39: fand(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0x21: fand(INDIRECT_X); break;
-        case 0x31: fand(INDIRECT_Y); cpu.cycles += bordercross; break;
-        
-        case 0x0A: asl(ACCUMULATOR); break;
-        case 0x06: asl(ZERO_PAGE); break;
-        case 0x16: asl(ZERO_PAGE_X); break;
-        case 0x0E: asl(ABSOLUTE); break;
-        case 0x1E: asl(ABSOLUTE_X); break;
-
-        case 0x90: bcc(RELATIVE); break;
-        case 0xB0: bcs(RELATIVE); break;
-        case 0xF0: beq(RELATIVE); break;
-        case 0x30: bmi(RELATIVE); break;
-        case 0xD0: bne(RELATIVE); break;
-        case 0x10: bpl(RELATIVE); break;
-        case 0x50: bvc(RELATIVE); break;
-        case 0x70: bvs(RELATIVE); break;
-
-        case 0x24: bit(ZERO_PAGE); break;
-        case 0x2C: bit(ABSOLUTE); break;
-
-        case 0x00: fbrk(IMPLIED); break;
-
-        case 0x18: clc(IMPLIED); break;
-        case 0xD8: cld(IMPLIED); break;
-        case 0x58: cli(IMPLIED); break;
-        case 0xB8: clv(IMPLIED); break;
-
-        case 0xC9: cmp(IMMEDIATE); break;
-        case 0xC5: cmp(ZERO_PAGE); break;
-        case 0xD5: cmp(ZERO_PAGE_X); break;
-        case 0xCD: cmp(ABSOLUTE); break;
-        case 0xDD: cmp(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0xD9: cmp(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0xC1: cmp(INDIRECT_X); break;
-        case 0xD1: cmp(INDIRECT_Y); cpu.cycles += bordercross; break;
-
-        case 0xE0: cpx(IMMEDIATE); break;
-        case 0xE4: cpx(ZERO_PAGE); break;
-        case 0xEC: cpx(ABSOLUTE); break;
-
-        case 0xC0: cpy(IMMEDIATE); break;
-        case 0xC4: cpy(ZERO_PAGE); break;
-        case 0xCC: cpy(ABSOLUTE); break;
-
-        case 0xC6: dec(ZERO_PAGE); break;
-        case 0xD6: dec(ZERO_PAGE_X); break;
-        case 0xCE: dec(ABSOLUTE); break;
-        case 0xDE: dec(ABSOLUTE_X); break;
-
-        case 0xCA: dex(IMPLIED); break;
-        case 0x88: dey(IMPLIED); break;
-
-        case 0x49: eor(IMMEDIATE); break;
-        case 0x45: eor(ZERO_PAGE); break;
-        case 0x55: eor(ZERO_PAGE_X); break;
-        case 0x4D: eor(ABSOLUTE); break;
-        case 0x5D: eor(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0x59: eor(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0x41: eor(INDIRECT_X); break;
-        case 0x51: eor(INDIRECT_Y); cpu.cycles += bordercross; break;
-
-        case 0xE6: inc(ZERO_PAGE); break;
-        case 0xF6: inc(ZERO_PAGE_X); break;
-        case 0xEE: inc(ABSOLUTE); break;
-        case 0xFE: inc(ABSOLUTE_X); break;
-
-        case 0xE8: inx(IMPLIED); break;
-        case 0xC8: iny(IMPLIED); break;
-
-        case 0x4C: jmp(ABSOLUTE); break;
-        case 0x6C: jmp(INDIRECT); break;
-
-        case 0x20: jsr(ABSOLUTE); break;
-
-        case 0xA1: lda(INDIRECT_X); break;
-        case 0xA5: lda(ZERO_PAGE); break;
-        case 0xA9: lda(IMMEDIATE); break;
-        case 0xAD: lda(ABSOLUTE); break;
-        case 0xB1: lda(INDIRECT_Y); cpu.cycles += bordercross; break;
-        case 0xB5: lda(ZERO_PAGE_X); break;
-        case 0xBD: lda(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0xB9: lda(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-
-        case 0xA2: ldx(IMMEDIATE); break;
-        case 0xA6: ldx(ZERO_PAGE); break;
-        case 0xB6: ldx(ZERO_PAGE_Y); break;
-        case 0xAE: ldx(ABSOLUTE); break;
-        case 0xBE: ldx(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-
-        case 0xA0: ldy(IMMEDIATE); break;
-        case 0xA4: ldy(ZERO_PAGE); break;
-        case 0xB4: ldy(ZERO_PAGE_X); break;
-        case 0xAC: ldy(ABSOLUTE); break;
-        case 0xBC: ldy(ABSOLUTE_X); cpu.cycles += bordercross; break;
-
-        case 0x4A: lsr(ACCUMULATOR); break;
-        case 0x46: lsr(ZERO_PAGE); break;
-        case 0x56: lsr(ZERO_PAGE_X); break;
-        case 0x4E: lsr(ABSOLUTE); break;
-        case 0x5E: lsr(ABSOLUTE_X); break;
-
-        case 0xEA: nop(IMPLIED); break;
-
-        case 0x09: ora(IMMEDIATE); break;
-        case 0x05: ora(ZERO_PAGE); break;
-        case 0x15: ora(ZERO_PAGE_X); break;
-        case 0x0D: ora(ABSOLUTE); break;
-        case 0x1D: ora(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0x19: ora(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0x01: ora(INDIRECT_X); break;
-        case 0x11: ora(INDIRECT_Y); cpu.cycles += bordercross; break;
-        
-        case 0x48: pha(IMPLIED); break;
-        case 0x08: php(IMPLIED); break;
-        case 0x68: pla(IMPLIED); break;
-        case 0x28: plp(IMPLIED); break;
-
-        case 0x2A: rol(ACCUMULATOR); break;
-        case 0x26: rol(ZERO_PAGE); break;
-        case 0x36: rol(ZERO_PAGE_X); break;
-        case 0x2E: rol(ABSOLUTE); break;
-        case 0x3E: rol(ABSOLUTE_X); break;
-
-        case 0x6A: ror(ACCUMULATOR); break;
-        case 0x66: ror(ZERO_PAGE); break;
-        case 0x76: ror(ZERO_PAGE_X); break;
-        case 0x6E: ror(ABSOLUTE); break;
-        case 0x7E: ror(ABSOLUTE_X); break;
-
-        case 0x40: rti(IMPLIED); break;
-
-        case 0x60: rts(IMPLIED); break;
-
-        case 0xE9: sbc(IMMEDIATE); break;
-        case 0xE5: sbc(ZERO_PAGE); break;
-        case 0xF5: sbc(ZERO_PAGE_X); break;
-        case 0xED: sbc(ABSOLUTE); break;
-        case 0xFD: sbc(ABSOLUTE_X); cpu.cycles += bordercross; break;
-        case 0xF9: sbc(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0xE1: sbc(INDIRECT_X); break;
-        case 0xF1: sbc(INDIRECT_Y); cpu.cycles += bordercross; break;
-
-        case 0x38: sec(IMPLIED); break;
-        case 0xF8: sed(IMPLIED); break;
-        case 0x78: sei(IMPLIED); break;
-
-        case 0x85: sta(ZERO_PAGE); break;
-        case 0x95: sta(ZERO_PAGE_X); break;
-        case 0x8D: sta(ABSOLUTE); break;
-        case 0x9D: sta(ABSOLUTE_X); break;
-        case 0x99: sta(ABSOLUTE_Y); break;
-        case 0x81: sta(INDIRECT_X); break; 
-        case 0x91: sta(INDIRECT_Y); break;
-
-        case 0x86: stx(ZERO_PAGE); break;
-        case 0x96: stx(ZERO_PAGE_Y); break;
-        case 0x8E: stx(ABSOLUTE); break;
-
-        case 0x84: sty(ZERO_PAGE); break;
-        case 0x94: sty(ZERO_PAGE_X); break;
-        case 0x8C: sty(ABSOLUTE); break;
-
-        case 0xAA: tax(IMPLIED); break;
-        case 0xA8: tay(IMPLIED); break;
-        case 0xBA: tsx(IMPLIED); break;
-        case 0x8A: txa(IMPLIED); break;
-        case 0x9A: txs(IMPLIED); break;
-        case 0x98: tya(IMPLIED); break;
-
-        //
-        // Below opcodes are undocumented and rarely used. Yet they are 
-        // required for proper emulation of specific software.
-        //
-        case 0x0B: anc(IMMEDIATE); break;
-        case 0x2B: anc(IMMEDIATE); break;
-
-        case 0x0F: slo(ABSOLUTE); break;
-        case 0x1F: slo(ABSOLUTE_X); break;
-        case 0x1B: slo(ABSOLUTE_Y); break;
-        case 0x07: slo(ZERO_PAGE); break;
-        case 0x17: slo(ZERO_PAGE_X); break;
-        case 0x03: slo(INDIRECT_X); break;
-        case 0x13: slo(INDIRECT_Y); break;
-
-        case 0xA7: lax(ZERO_PAGE); break;
-        case 0xB7: lax(ZERO_PAGE_Y); break;
-        case 0xAF: lax(ABSOLUTE); break;
-        case 0xBF: lax(ABSOLUTE_Y); cpu.cycles += bordercross; break;
-        case 0xA3: lax(INDIRECT_X); break;
-        case 0xB3: lax(INDIRECT_Y); cpu.cycles += bordercross; break;
-
-        case 0x87: sax(ZERO_PAGE); break;
-        case 0x97: sax(ZERO_PAGE_Y); break;
-        case 0x8F: sax(ABSOLUTE); break;
-        case 0x83: sax(INDIRECT_X); break;
-
-        case 0x47: sre(ZERO_PAGE); break;
-        case 0x57: sre(ZERO_PAGE_X); break;
-        case 0x4F: sre(ABSOLUTE); break;
-        case 0x5F: sre(ABSOLUTE_X); break;
-        case 0x5B: sre(ABSOLUTE_Y); break;
-        case 0x43: sre(INDIRECT_X); break;
-        case 0x53: sre(INDIRECT_Y); break;
-
-        case 0x27: rla(ZERO_PAGE); break;
-        case 0x37: rla(ZERO_PAGE_X); break;
-        case 0x2F: rla(ABSOLUTE); break;
-        case 0x3F: rla(ABSOLUTE_X); break;
-        case 0x3B: rla(ABSOLUTE_Y); break;
-        case 0x23: rla(INDIRECT_X); break;
-        case 0x33: rla(INDIRECT_Y); break;
-        
-        case 0x4B: alr(IMMEDIATE); break;
-
-        case 0xBB: las(ABSOLUTE_Y); break;
-
-        case 0x6B: arr(IMMEDIATE); break;
-
-        case 0xEB: sbc(IMMEDIATE); break;
-
-        case 0xCB: sbx(IMMEDIATE); break;
-
-        case 0xC7: dcp(ZERO_PAGE); break;
-        case 0xD7: dcp(ZERO_PAGE_X); break;
-        case 0xCF: dcp(ABSOLUTE); break;
-        case 0xDF: dcp(ABSOLUTE_X); break;
-        case 0xDB: dcp(ABSOLUTE_Y); break;
-        case 0xC3: dcp(INDIRECT_X); break;
-        case 0xD3: dcp(INDIRECT_Y); break;
-
-        // 
-        // Multiple opcodes generate nops with different address modes)
-        //
-        case 0x80: 
-        case 0x82: 
-        case 0x89: 
-        case 0xC2: 
-        case 0xE2: nop(IMMEDIATE); printf("undocumented nop %2X\n", command); break;
-        
-        case 0x04: 
-        case 0x44: 
-        case 0x64: nop(ZERO_PAGE); printf("undocumented nop %2X\n", command); break;
-
-        case 0x14:
-        case 0x34:
-        case 0x54:
-        case 0x74:
-        case 0xD4:
-        case 0xF4: nop(ZERO_PAGE_X); printf("undocumented nop %2X\n", command); break;
-
-        case 0x0C: nop(ABSOLUTE); printf("undocumented nop %2X\n", command); break;
-
-        //
-        // These nops use ABSOLUTE_X addressing mode, which affect timing 
-        // in case of page border cross
-        //
-        case 0x1C:
-        case 0x3C:
-        case 0x5C:
-        case 0x7C:
-        case 0xDC:
-        case 0xFC: nop(ABSOLUTE_X); printf("undocumented nop %2X", command); cpu.cycles += bordercross; break;
-
-        // 
-        // Opcodes below cause CPU to halt execution and are called
-        // JAM by some assemblers. We do not implement JAM, treating 
-        // them as NOPS, but we print a message. 
-        //
-        case 0x02: 
-        case 0x12: 
-        case 0x22:
-        case 0x32:
-        case 0x42:
-        case 0x52:
-        case 0x62:
-        case 0x72:
-        case 0x92:
-        case 0xB2:
-        case 0xD2:
-        case 0xF2: nop(IMPLIED); printf("JAM detected, execution continues %2X\n", command); break;
-
-        // 
-        // Unstable opcodes are not yet implemented but issue warnings
-        //
-        case 0x93 : sha(ZERO_PAGE_Y); break;
-        case 0x9F : sha(ABSOLUTE_Y); break;
-        case 0x9E : shx(ABSOLUTE_Y); break;
-        case 0x9C : shy(ABSOLUTE_X); break;
-        case 0x9B : tas(ABSOLUTE_Y); break;
-        case 0x8B : ane(IMMEDIATE); break;
-        case 0xAB : lax(IMMEDIATE); break;
-
-
-        // 
-        // This includes undocumented NOPs: 
-        // 1A, 3A, 5A, 7A, DA, FA
-        //
-        default: nop(IMPLIED); printf("undocumented nop, %2X\n", command); break;
-
-    }
-#ifdef DEBUG
-    fprintf(stderr,"\n");
-#endif 
-    return 0;
-}
+//
+// Class of each opcode, for the engines working on more than one opcode at
+// a time: the JIT compiler (see jitcompile) and the lockstep runner (see
+// runlockstep). KIND_HELPER opcodes have no class of their own, the JIT
+// calls their body in C and the lockstep runner runs them lane by lane.
+//
+#define KIND_HELPER 0
+#define KIND_LDA 1                  // opcodes reading memory, up to KIND_SBC
+#define KIND_LDX 2
+#define KIND_LDY 3
+#define KIND_AND 4
+#define KIND_ORA 5
+#define KIND_EOR 6
+#define KIND_CMP 7
+#define KIND_CPX 8
+#define KIND_CPY 9
+#define KIND_BIT 10
+#define KIND_ADC 11
+#define KIND_SBC 12
+#define KIND_STA 13
+#define KIND_STX 14
+#define KIND_STY 15
+#define KIND_INC 16
+#define KIND_DEC 17
+#define KIND_ASL 18
+#define KIND_LSR 19
+#define KIND_ROL 20
+#define KIND_ROR 21
+#define KIND_INX 22
+#define KIND_INY 23
+#define KIND_DEX 24
+#define KIND_DEY 25
+#define KIND_TAX 26
+#define KIND_TAY 27
+#define KIND_TXA 28
+#define KIND_TYA 29
+#define KIND_TSX 30
+#define KIND_TXS 31
+#define KIND_CLC 32
+#define KIND_SEC 33
+#define KIND_SEI 34
+#define KIND_CLD 35
+#define KIND_SED 36
+#define KIND_CLV 37
+#define KIND_NOP 38
+#define KIND_BRANCH 39
+#define KIND_JMP 40
+
+static const unsigned char opkind[256] = {
+    KIND_HELPER, KIND_ORA   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ORA   , KIND_ASL   , KIND_HELPER, KIND_HELPER, KIND_ORA   , KIND_ASL   , KIND_HELPER, KIND_HELPER, KIND_ORA   , KIND_ASL   , KIND_HELPER,  // 00
+    KIND_BRANCH, KIND_ORA   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ORA   , KIND_ASL   , KIND_HELPER, KIND_CLC   , KIND_ORA   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ORA   , KIND_ASL   , KIND_HELPER,  // 10
+    KIND_HELPER, KIND_AND   , KIND_HELPER, KIND_HELPER, KIND_BIT   , KIND_AND   , KIND_ROL   , KIND_HELPER, KIND_HELPER, KIND_AND   , KIND_ROL   , KIND_HELPER, KIND_BIT   , KIND_AND   , KIND_ROL   , KIND_HELPER,  // 20
+    KIND_BRANCH, KIND_AND   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_AND   , KIND_ROL   , KIND_HELPER, KIND_SEC   , KIND_AND   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_AND   , KIND_ROL   , KIND_HELPER,  // 30
+    KIND_HELPER, KIND_EOR   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_EOR   , KIND_LSR   , KIND_HELPER, KIND_HELPER, KIND_EOR   , KIND_LSR   , KIND_HELPER, KIND_JMP   , KIND_EOR   , KIND_LSR   , KIND_HELPER,  // 40
+    KIND_BRANCH, KIND_EOR   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_EOR   , KIND_LSR   , KIND_HELPER, KIND_HELPER, KIND_EOR   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_EOR   , KIND_LSR   , KIND_HELPER,  // 50
+    KIND_HELPER, KIND_ADC   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ADC   , KIND_ROR   , KIND_HELPER, KIND_HELPER, KIND_ADC   , KIND_ROR   , KIND_HELPER, KIND_HELPER, KIND_ADC   , KIND_ROR   , KIND_HELPER,  // 60
+    KIND_BRANCH, KIND_ADC   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ADC   , KIND_ROR   , KIND_HELPER, KIND_SEI   , KIND_ADC   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_ADC   , KIND_ROR   , KIND_HELPER,  // 70
+    KIND_HELPER, KIND_STA   , KIND_HELPER, KIND_HELPER, KIND_STY   , KIND_STA   , KIND_STX   , KIND_HELPER, KIND_DEY   , KIND_HELPER, KIND_TXA   , KIND_HELPER, KIND_STY   , KIND_STA   , KIND_STX   , KIND_HELPER,  // 80
+    KIND_BRANCH, KIND_STA   , KIND_HELPER, KIND_HELPER, KIND_STY   , KIND_STA   , KIND_STX   , KIND_HELPER, KIND_TYA   , KIND_STA   , KIND_TXS   , KIND_HELPER, KIND_HELPER, KIND_STA   , KIND_HELPER, KIND_HELPER,  // 90
+    KIND_LDY   , KIND_LDA   , KIND_LDX   , KIND_HELPER, KIND_LDY   , KIND_LDA   , KIND_LDX   , KIND_HELPER, KIND_TAY   , KIND_LDA   , KIND_TAX   , KIND_HELPER, KIND_LDY   , KIND_LDA   , KIND_LDX   , KIND_HELPER,  // A0
+    KIND_BRANCH, KIND_LDA   , KIND_HELPER, KIND_HELPER, KIND_LDY   , KIND_LDA   , KIND_LDX   , KIND_HELPER, KIND_CLV   , KIND_LDA   , KIND_TSX   , KIND_HELPER, KIND_LDY   , KIND_LDA   , KIND_LDX   , KIND_HELPER,  // B0
+    KIND_CPY   , KIND_CMP   , KIND_HELPER, KIND_HELPER, KIND_CPY   , KIND_CMP   , KIND_DEC   , KIND_HELPER, KIND_INY   , KIND_CMP   , KIND_DEX   , KIND_HELPER, KIND_CPY   , KIND_CMP   , KIND_DEC   , KIND_HELPER,  // C0
+    KIND_BRANCH, KIND_CMP   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_CMP   , KIND_DEC   , KIND_HELPER, KIND_CLD   , KIND_CMP   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_CMP   , KIND_DEC   , KIND_HELPER,  // D0
+    KIND_CPX   , KIND_SBC   , KIND_HELPER, KIND_HELPER, KIND_CPX   , KIND_SBC   , KIND_INC   , KIND_HELPER, KIND_INX   , KIND_SBC   , KIND_NOP   , KIND_HELPER, KIND_CPX   , KIND_SBC   , KIND_INC   , KIND_HELPER,  // E0
+    KIND_BRANCH, KIND_SBC   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_SBC   , KIND_INC   , KIND_HELPER, KIND_SED   , KIND_SBC   , KIND_HELPER, KIND_HELPER, KIND_HELPER, KIND_SBC   , KIND_INC   , KIND_HELPER };// F0
 
-void interrupt ()
+//
+// Write the trace record of the opcode read at pc, once it was executed. The
+// operand bytes are read again from the bus, but only from direct pages, as 
+// reading an I/O page could change the state of the device. Kept out of line
+// so the run loop only pays the test on cpu->trace.records when the trace is 
+// off.
+//
+__attribute((noinline)) static void tracestep(struct microprocessor *cpu, unsigned short pc, unsigned char command)
 {
-    unsigned char operand_l, operand_h;
-#ifdef DEBUG
-    fprintf(stderr,"External Interrupt ");
-#endif 
-    if (!(cpu.status&0x04)) {
-        operand_l = (char) (cpu.pc);
-        operand_h = (char) ((cpu.pc)>>8);
-        writememory(0x100+cpu.sp, operand_h);
-        cpu.sp--;
-        writememory(0x100+cpu.sp, operand_l);
-        cpu.sp--;
-        writememory(0x100+cpu.sp, cpu.status | 0x20);  // set bits break and reserved to true on the stack copy of the status register
-        cpu.sp--;
-        cpu.status |= 0x04;
-        operand_l = readmemory(0xFFFE);
-        operand_h = readmemory(0xFFFF);
-        cpu.pc = (unsigned short) ((operand_h<<8) | (operand_l));
-        cpu.status |= 0x04;
-        cpu.cycles += 7;
-    }
-}
-
-void nmi ()
+    struct tracerecord *record = &cpu->trace.records[cpu->trace.count++ & cpu->trace.mask];
+    unsigned short address;
+    unsigned char *page;
+    int i;
+
+    record->cycles = (unsigned int) cpu->cycles;
+    record->pc = pc;
+    record->address = cpu->address;
+    record->opcode = command;
+    for (i = 0; i < 2; i++) {
+        address = (unsigned short) (pc + 1 + i);
+        page = cpu->bus.readpage[address >> 8];
+        record->operand[i] = page ? page[address & 0xFF] : 0xFF;
+    }
+    record->a = cpu->a;
+    record->x = cpu->x;
+    record->y = cpu->y;
+    record->sp = cpu->sp;
+    record->status = getstatus(cpu);
+}
+
+//
+// Enter a call to address in the tree of the profile. sp is the stack 
+// pointer right after the call, the call is over once an rts or rti leaves
+// the stack above it.
+//
+static void profilecall(struct profile *profile, unsigned short address, unsigned char sp)
 {
-    unsigned char operand_l, operand_h;
-#ifdef DEBUG
-    fprintf(stderr,"External Non-Maskable Interrupt ");
-#endif 
-    operand_l = (char) (cpu.pc);
-    operand_h = (char) ((cpu.pc)>>8);
-    writememory(0x100+cpu.sp, operand_h);
-    cpu.sp--;
-    writememory(0x100+cpu.sp, operand_l);
-    cpu.sp--;
-    writememory(0x100+cpu.sp, cpu.status | 0x20);  // set bits break and reserved to true on the stack copy of the status register
-    cpu.sp--;
-    cpu.status |= 0x04;
-    operand_l = readmemory(0xFFFA);
-    operand_h = readmemory(0xFFFB);
-    cpu.pc = (unsigned short) ((operand_h<<8) | (operand_l));
-    cpu.status |= 0x04;
-    cpu.cycles += 7;
+    int parent = profile->frames[profile->depth];
+    int bucket = (parent * 31 + address) & (PROFILE_NODES - 1);
+    struct profilenode *node;
+    int index;
+
+    if (profile->depth + 1 >= PROFILE_DEPTH) {
+        profile->lost++;
+        return;
+    }
+    for (index = profile->hash[bucket]; index >= 0; index = profile->nodes[index].next) {
+        if (profile->nodes[index].parent == parent && profile->nodes[index].address == address) break;
+    }
+    if (index < 0 && profile->nodecount < PROFILE_NODES) {
+        index = profile->nodecount++;
+        node = &profile->nodes[index];
+        node->address = address;
+        node->parent = parent;
+        node->count = 0;
+        node->cycles = 0;
+        node->next = profile->hash[bucket];
+        profile->hash[bucket] = index;
+    }
+    else if (index < 0) {
+        profile->lost++;
+        index = parent;
+    }
+    profile->depth++;
+    profile->frames[profile->depth] = index;
+    profile->sp[profile->depth] = sp;
+}
+
+//
+// Count the opcode read at pc in the profile, once it was executed, with the
+// cycles spent since the last opcode. An opcode that is not where the last 
+// one left the pc starts an interrupt handler (or the user code moved the 
+// pc), which is entered as a call, with the 3 bytes pushed by the interrupt.
+// Kept out of line as traceopcode.
+//
+__attribute((noinline)) static void profilestep(struct microprocessor *cpu, unsigned short pc, unsigned char command)
+{
+    struct profile *profile = cpu->profile;
+    unsigned long spent = cpu->cycles >= profile->last ? cpu->cycles - profile->last : 0;
+    struct profilenode *node;
+
+    if (pc != profile->next) profilecall(profile, pc, (unsigned char) (profile->lastsp - 3));
+    profile->count[pc]++;
+    profile->cycles[pc] += spent;
+    profile->opcodecount[command]++;
+    profile->opcodecycles[command] += spent;
+    node = &profile->nodes[profile->frames[profile->depth]];
+    node->count++;
+    node->cycles += spent;
+
+    if (command == 0x20 || command == 0x00) profilecall(profile, cpu->pc, cpu->sp);
+    else if (command == 0x60 || command == 0x40) {
+        while (profile->depth && profile->sp[profile->depth] < cpu->sp) profile->depth--;
+    }
+    profile->last = cpu->cycles;
+    profile->next = cpu->pc;
+    profile->lastsp = cpu->sp;
+}
+
+//
+// Page crossing penalty of the opcode just executed. The indexed mode 
+// functions set bordercross when the index crosses a page, but only the
+// opcodes with OPCODE_PENALTY (the ones reading memory) take the extra
+// cycle. The engines call it after each body with the opcode as a constant,
+// so the test only remains in the bodies of those opcodes.
+//
+__attribute((always_inline)) static inline void pagepenalty(struct microprocessor *cpu, unsigned char command)
+{
+    cpu->cycles += cpu->bordercross & (opcodeinfo[command].flags & OPCODE_PENALTY) / OPCODE_PENALTY;
+}
+
+__attribute((always_inline)) static inline void traceopcode(struct microprocessor *cpu, unsigned short pc, unsigned char command)
+{
+    if (__builtin_expect(cpu->trace.records != 0, 0)) tracestep(cpu, pc, command);
+    if (__builtin_expect(cpu->profile != 0, 0)) profilestep(cpu, pc, command);
+}
+
+//
+// Report a diagnostic event for the opcode being executed. Called first in 
+// the opcode body, so the opcode was read from cpu->pc - 1. Kept out of line
+// as only undocumented opcodes call it.
+//
+__attribute((noinline, cold)) static void diagnostic(struct microprocessor *cpu, unsigned char opcode, int kind)
+{
+    struct diagnostics *diag = &cpu->diag;
+
+    diag->count[kind]++;
+    if (!diag->handler) return;
+    if (diag->limit) {
+        if (cpu->cycles - diag->windowstart >= diag->window) {
+            diag->windowstart = cpu->cycles;
+            diag->reported = 0;
+        }
+        if (diag->reported >= diag->limit) {
+            diag->dropped++;
+            return;
+        }
+        diag->reported++;
+    }
+    diag->handler(diag->context, opcode, (unsigned short) (cpu->pc - 1), kind);
+}
+
+// 
+// Switch case to execute CPU command based on opcode. Inlined in processcommand
+// and in the switch version of the run loop.
+//
+__attribute((always_inline)) static inline void execute(struct microprocessor *cpu)
+{ 
+    unsigned short pc = cpu->pc;
+    unsigned char command;
+
+    cpu->bordercross = 0;
+    command = fetchmemory(cpu);
+    cpu->cycles += opcodeinfo[command].cycles;
+    
+    switch (command)
+    {
+#define OPCODE(code, body) case code: body; pagepenalty(cpu, code); break;
+#include "opcodes.h"
+#undef OPCODE
+    }
+    traceopcode(cpu, pc, command);
+}
+
+//
+// Cycle exact engine, used instead of execute and the other engines when
+// setcycleexact is on. The 6502 uses the bus on every cycle, so here every
+// cycle is one call to cycleread or cyclewrite, and the cycle counter is 
+// incremented by the access itself instead of by opcodeinfo up front: a bus 
+// handler called for an access finds in cpu->cycles the number of that cycle.
+//
+// The engine runs the same bodies of opcodes.h. The macros below replace the
+// mode functions and the handlers doing bus accesses by versions doing the
+// accesses of the real chip, in order, including the ones whose value is 
+// thrown away:
+//
+// - opcodes of a single byte read the byte after the opcode
+// - zero page indexed and (zp,x) modes read the zero page address before 
+//   adding the index
+// - absolute indexed and (zp),y modes read the address before the carry to
+//   the high byte is fixed, always when writing and only on a page cross 
+//   when reading
+// - read-modify-write opcodes write back the value read, then the result
+// - pulls and returns read the stack before moving the stack pointer, rts
+//   reads the byte before the return address, jsr reads the stack between
+//   the two bytes of its operand
+// - taken branches read the next opcode, and the wrong page when crossing 
+//
+// Each opcode takes the same cycles as in the other engines, so the engines
+// can be switched between two opcodes.
+//
+#define PENDING_NONE 0              // no address referenced yet
+#define PENDING_ADDRESS 1           // address without a dummy read
+#define PENDING_INDEXED 2           // indexed in the same page, writes read it first
+#define PENDING_CROSSED 3           // indexed across a page, partial read first
+
+__attribute((always_inline)) static inline unsigned char cycleread(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char value = readmemory(cpu, address);
+    cpu->cycles++;
+    return value;
+}
+
+__attribute((always_inline)) static inline void cyclewrite(struct microprocessor *cpu, unsigned short address, unsigned char value)
+{
+    writememory(cpu, address, value);
+    cpu->cycles++;
+}
+
+__attribute((always_inline)) static inline unsigned char exactfetch(struct microprocessor *cpu)
+{
+    return cycleread(cpu, cpu->pc++);
+}
+
+__attribute((always_inline)) static inline unsigned short exactfetchword(struct microprocessor *cpu)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    operand_l = exactfetch(cpu);
+    operand_h = exactfetch(cpu);
+    return (unsigned short) ( operand_h << 8 | operand_l );
+}
+
+//
+// Addressing modes. The address is kept for the access done by the handler,
+// with the partial address of the indexed modes, which the chip reads first.
+//
+__attribute((always_inline)) static inline unsigned short exactaddress(struct microprocessor *cpu, unsigned short address)
+{
+    cpu->pending = PENDING_ADDRESS;
+    return traceaddress(cpu, address);
+}
+
+__attribute((always_inline)) static inline unsigned short exactindexed(struct microprocessor *cpu, unsigned short base, unsigned char index)
+{
+    unsigned short address = base + index;
+    cpu->partial = (base & 0xFF00) | (address & 0x00FF);
+    cpu->pending = cpu->partial == address ? PENDING_INDEXED : PENDING_CROSSED;
+    return traceaddress(cpu, address);
+}
+
+__attribute((always_inline)) static inline unsigned short exactzeropage(struct microprocessor *cpu, unsigned char operand)
+{
+    return exactaddress(cpu, operand);
+}
+
+__attribute((always_inline)) static inline unsigned short exactzeropagex(struct microprocessor *cpu, unsigned char operand)
+{
+    cycleread(cpu, operand);
+    return exactaddress(cpu, (operand + cpu->x) & 0xFF);
+}
+
+__attribute((always_inline)) static inline unsigned short exactzeropagey(struct microprocessor *cpu, unsigned char operand)
+{
+    cycleread(cpu, operand);
+    return exactaddress(cpu, (operand + cpu->y) & 0xFF);
+}
+
+__attribute((always_inline)) static inline unsigned short exactabsolute(struct microprocessor *cpu, unsigned short operand)
+{
+    return exactaddress(cpu, operand);
+}
+
+__attribute((always_inline)) static inline unsigned short exactabsolutex(struct microprocessor *cpu, unsigned short operand)
+{
+    return exactindexed(cpu, operand, cpu->x);
+}
+
+__attribute((always_inline)) static inline unsigned short exactabsolutey(struct microprocessor *cpu, unsigned short operand)
+{
+    return exactindexed(cpu, operand, cpu->y);
+}
+
+__attribute((always_inline)) static inline unsigned short exactindirect(struct microprocessor *cpu, unsigned short operand)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    // same page bug as indirect, but the low byte is read first
+    operand_l = cycleread(cpu, operand);
+    operand_h = cycleread(cpu, (operand & 0xFF00) | ((operand + 1) & 0x00FF));
+    return exactaddress(cpu, (unsigned short) ( operand_h << 8 | operand_l ));
+}
+
+__attribute((always_inline)) static inline unsigned short exactindirectx(struct microprocessor *cpu, unsigned char operand)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    unsigned char pointer = operand + cpu->x;
+    cycleread(cpu, operand);
+    operand_l = cycleread(cpu, pointer);
+    operand_h = cycleread(cpu, (unsigned char) (pointer + 1));
+    return exactaddress(cpu, (unsigned short) ( operand_h << 8 | operand_l ));
+}
+
+__attribute((always_inline)) static inline unsigned short exactindirecty(struct microprocessor *cpu, unsigned char operand)
+{
+    unsigned char operand_l;
+    unsigned char operand_h;
+    operand_l = cycleread(cpu, operand);
+    operand_h = cycleread(cpu, (unsigned char) (operand + 1));
+    return exactindexed(cpu, (unsigned short) ( operand_h << 8 | operand_l ), cpu->y);
+}
+
+//
+// Accesses to the address of the opcode: a read, a write, and the read and 
+// unchanged write back of a read-modify-write opcode.
+//
+__attribute((always_inline)) static inline unsigned char exactload(struct microprocessor *cpu, unsigned short address)
+{
+    if (cpu->pending == PENDING_CROSSED) cycleread(cpu, cpu->partial);
+    return cycleread(cpu, address);
+}
+
+__attribute((always_inline)) static inline void exactstore(struct microprocessor *cpu, unsigned short address, unsigned char value)
+{
+    if (cpu->pending >= PENDING_INDEXED) cycleread(cpu, cpu->partial);
+    cyclewrite(cpu, address, value);
+}
+
+__attribute((always_inline)) static inline unsigned char exactmodify(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char value;
+    if (cpu->pending >= PENDING_INDEXED) cycleread(cpu, cpu->partial);
+    value = cycleread(cpu, address);
+    cyclewrite(cpu, address, value);
+    return value;
+}
+
+//
+// Handlers doing bus accesses. The undocumented nops read their address, 
+// if they have one.
+//
+__attribute((always_inline)) static inline void exactnop(struct microprocessor *cpu, unsigned short operand)
+{
+    if (cpu->pending != PENDING_NONE) exactload(cpu, operand);
+}
+
+__attribute((always_inline)) static inline void exactasl(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = shiftleft(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactlsr(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = shiftright(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactrol(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = rotateleft(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactror(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = rotateright(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactinc(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = exactmodify(cpu, address) + 1;
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactdec(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = exactmodify(cpu, address) - 1;
+    cyclewrite(cpu, address, val);
+    SETNZ(val);                     // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactslo(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = shiftleft(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    cpu->a |= val;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactrla(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char val = rotateleft(cpu, exactmodify(cpu, address));
+    cyclewrite(cpu, address, val);
+    cpu->a &= val;
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactsre(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char value = exactmodify(cpu, address);
+    cyclewrite(cpu, address, shiftright(cpu, value));
+    cpu->a ^= value;                // as sre above
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactdcp(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char tmp = exactmodify(cpu, address) - 1;
+    cyclewrite(cpu, address, tmp);
+    SETC(cpu->a >= tmp);               // set bit carry on status processor to true
+    SETNZ(cpu->a - tmp);               // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactsh(struct microprocessor *cpu, unsigned short address, unsigned char value)
+{
+    exactstore(cpu, address, value & (unsigned char) (((address & 0xFF00)>>8)+1));
+}
+
+__attribute((always_inline)) static inline void exacttas(struct microprocessor *cpu, unsigned short address)
+{
+    cpu->sp = cpu->x & cpu->a;
+    exactsh(cpu, address, cpu->sp);
+}
+
+__attribute((always_inline)) static inline void exactbranch(struct microprocessor *cpu, unsigned char branch, int taken)
+{
+    unsigned short address;
+    if (!taken) return;
+    cycleread(cpu, cpu->pc);
+    address = cpu->pc + (signed char) branch;
+    if ((address & 0xFF00) != (cpu->pc & 0xFF00)) cycleread(cpu, (cpu->pc & 0xFF00) | (address & 0x00FF));
+    cpu->pc = address;
+}
+
+__attribute((always_inline)) static inline void exactpush(struct microprocessor *cpu, unsigned char value)
+{
+    cyclewrite(cpu, 0x100+cpu->sp, value);
+    cpu->sp--;
+}
+
+__attribute((always_inline)) static inline unsigned char exactpull(struct microprocessor *cpu)
+{
+    cpu->sp++;
+    return cycleread(cpu, 0x100+cpu->sp);
+}
+
+__attribute((always_inline)) static inline void exactpla(struct microprocessor *cpu)
+{
+    cycleread(cpu, 0x100+cpu->sp);
+    cpu->a = exactpull(cpu);
+    SETNZ(cpu->a);                  // set bits zero and negative on status processor
+}
+
+__attribute((always_inline)) static inline void exactplp(struct microprocessor *cpu)
+{
+    cycleread(cpu, 0x100+cpu->sp);
+    putstatus(cpu, exactpull(cpu) & 0xEF); //unset break flag
+    delayirq(cpu);
+}
+
+__attribute((always_inline)) static inline void exactjsr(struct microprocessor *cpu)
+{
+    unsigned char operand_l, operand_h;
+    operand_l = exactfetch(cpu);
+    cycleread(cpu, 0x100+cpu->sp);
+    // the pc points to the last operand byte, which is the return address pushed
+    exactpush(cpu, (unsigned char) (cpu->pc>>8));
+    exactpush(cpu, (unsigned char) cpu->pc);
+    operand_h = cycleread(cpu, cpu->pc);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+}
+
+__attribute((always_inline)) static inline void exactrts(struct microprocessor *cpu)
+{
+    unsigned char operand_l, operand_h;
+    cycleread(cpu, 0x100+cpu->sp);
+    operand_l = exactpull(cpu);
+    operand_h = exactpull(cpu);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+    cycleread(cpu, cpu->pc++);
+}
+
+__attribute((always_inline)) static inline void exactrti(struct microprocessor *cpu)
+{
+    unsigned char operand_l, operand_h;
+    cycleread(cpu, 0x100+cpu->sp);
+    putstatus(cpu, exactpull(cpu) & 0xCF); // clear bits 4 and 5 when restablishing the status register
+    operand_l = exactpull(cpu);
+    operand_h = exactpull(cpu);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+    updateirq(cpu);
+}
+
+//
+// brk, interrupts and nmi push the pc and the status and jump through vector.
+// brk skips the byte after the opcode, interrupts read the opcode they are 
+// taken on twice instead.
+//
+__attribute((always_inline)) static inline void exactvector(struct microprocessor *cpu, unsigned short vector, unsigned char status)
+{
+    unsigned char operand_l, operand_h;
+    exactpush(cpu, (unsigned char) (cpu->pc>>8));
+    exactpush(cpu, (unsigned char) cpu->pc);
+    exactpush(cpu, status);
+    cpu->status |= 0x04;
+    cpu->signals &= ~SIGNAL_IRQ;
+    operand_l = cycleread(cpu, vector);
+    operand_h = cycleread(cpu, vector + 1);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+}
+
+__attribute((always_inline)) static inline void exactbrk(struct microprocessor *cpu)
+{
+    cpu->pc++;
+    exactvector(cpu, 0xFFFE, getstatus(cpu) | 0x30);  // set bits break and reserved to true on the stack copy of the status register
+}
+
+static void exactinterrupt(struct microprocessor *cpu, unsigned short vector)
+{
+    cycleread(cpu, cpu->pc);
+    cycleread(cpu, cpu->pc);
+    exactvector(cpu, vector, getstatus(cpu) | 0x20);  // set bit reserved to true on the stack copy of the status register
+}
+
+#undef OPERAND8
+#undef OPERAND16
+#define OPERAND8 exactfetch(cpu)
+#define OPERAND16 exactfetchword(cpu)
+#define zeropage exactzeropage
+#define zeropagex exactzeropagex
+#define zeropagey exactzeropagey
+#define absolute exactabsolute
+#define absolutex exactabsolutex
+#define absolutey exactabsolutey
+#define indirect exactindirect
+#define indirectx exactindirectx
+#define indirecty exactindirecty
+#define readmemory exactload
+#define nop exactnop
+#define asl exactasl
+#define lsr exactlsr
+#define rol exactrol
+#define ror exactror
+#define inc exactinc
+#define dec exactdec
+#define slo exactslo
+#define rla exactrla
+#define sre exactsre
+#define dcp exactdcp
+#define tas exacttas
+#define sta(cpu, address) exactstore(cpu, address, cpu->a)
+#define stx(cpu, address) exactstore(cpu, address, cpu->x)
+#define sty(cpu, address) exactstore(cpu, address, cpu->y)
+#define sax(cpu, address) exactstore(cpu, address, cpu->a & cpu->x)
+#define sha(cpu, address) exactsh(cpu, address, cpu->a & cpu->x)
+#define shx(cpu, address) exactsh(cpu, address, cpu->x)
+#define shy(cpu, address) exactsh(cpu, address, cpu->y)
+#define bcc(cpu, branch) exactbranch(cpu, branch, !FLAGC)
+#define bcs(cpu, branch) exactbranch(cpu, branch, FLAGC)
+#define beq(cpu, branch) exactbranch(cpu, branch, FLAGZ)
+#define bmi(cpu, branch) exactbranch(cpu, branch, FLAGN)
+#define bne(cpu, branch) exactbranch(cpu, branch, !FLAGZ)
+#define bpl(cpu, branch) exactbranch(cpu, branch, !FLAGN)
+#define bvc(cpu, branch) exactbranch(cpu, branch, !FLAGV)
+#define bvs(cpu, branch) exactbranch(cpu, branch, FLAGV)
+#define pha(cpu) exactpush(cpu, cpu->a)
+#define php(cpu) exactpush(cpu, getstatus(cpu) | 0x30)
+#define pla exactpla
+#define plp exactplp
+#define jsr(cpu, address) exactjsr(cpu)
+#define rts exactrts
+#define rti exactrti
+#define fbrk exactbrk
+
+//
+// Execute one opcode cycle by cycle. Kept out of line, the cycle exact engine
+// is not meant to be fast.
+//
+__attribute((noinline)) static void exactexecute(struct microprocessor *cpu)
+{
+    unsigned short pc = cpu->pc;
+    unsigned char command;
+
+    cpu->bordercross = 0;
+    cpu->pending = PENDING_NONE;
+    command = exactfetch(cpu);
+    if ((opcodeinfo[command].flags & OPCODE_SIZE) == 1) cycleread(cpu, cpu->pc);
+
+    switch (command)
+    {
+#define OPCODE(code, body) case code: body; break;
+#include "opcodes.h"
+#undef OPCODE
+    }
+    traceopcode(cpu, pc, command);
+}
+
+#undef zeropage
+#undef zeropagex
+#undef zeropagey
+#undef absolute
+#undef absolutex
+#undef absolutey
+#undef indirect
+#undef indirectx
+#undef indirecty
+#undef readmemory
+#undef nop
+#undef asl
+#undef lsr
+#undef rol
+#undef ror
+#undef inc
+#undef dec
+#undef slo
+#undef rla
+#undef sre
+#undef dcp
+#undef tas
+#undef sta
+#undef stx
+#undef sty
+#undef sax
+#undef sha
+#undef shx
+#undef shy
+#undef bcc
+#undef bcs
+#undef beq
+#undef bmi
+#undef bne
+#undef bpl
+#undef bvc
+#undef bvs
+#undef pha
+#undef php
+#undef pla
+#undef plp
+#undef jsr
+#undef rts
+#undef rti
+#undef fbrk
+#undef OPERAND8
+#undef OPERAND16
+#define OPERAND8 fetchmemory(cpu)
+#define OPERAND16 fetchword(cpu)
+
+//
+// Push the pc and the status and jump through vector, for an interrupt or
+// an nmi. Takes 7 cycles, done one by one in the cycle exact engine.
+//
+static void entervector(struct microprocessor *cpu, unsigned short vector)
+{
+    unsigned char operand_l, operand_h;
+    if (cpu->exact) {
+        exactinterrupt(cpu, vector);
+        return;
+    }
+    operand_l = (char) (cpu->pc);
+    operand_h = (char) ((cpu->pc)>>8);
+    writememory(cpu, 0x100+cpu->sp, operand_h);
+    cpu->sp--;
+    writememory(cpu, 0x100+cpu->sp, operand_l);
+    cpu->sp--;
+    writememory(cpu, 0x100+cpu->sp, getstatus(cpu) | 0x20);  // set bits break and reserved to true on the stack copy of the status register
+    cpu->sp--;
+    cpu->status |= 0x04;
+    cpu->signals &= ~SIGNAL_IRQ;
+    operand_l = readmemory(cpu, vector);
+    operand_h = readmemory(cpu, vector + 1);
+    cpu->pc = (unsigned short) ((operand_h<<8) | (operand_l));
+    cpu->cycles += 7;
+}
+
+//
+// Called by the run loops between two opcodes when cpu->signals is not zero.
+// Takes a pending nmi or irq, or works out the irq bit one opcode after cli
+// or plp cleared the interrupt flag.
+//
+__attribute((noinline)) static void pollsignals(struct microprocessor *cpu)
+{
+    unsigned char signals = cpu->signals;
+
+    cpu->signals &= ~(SIGNAL_NMI | SIGNAL_DELAY);
+    if (signals & SIGNAL_NMI) entervector(cpu, 0xFFFA);
+    else if (signals & SIGNAL_IRQ) entervector(cpu, 0xFFFE);
+    else updateirq(cpu);
+}
+
+//
+// Called when the library is entered from the user code, which may have
+// cleared the interrupt flag. Not after cli or plp, whose irq is taken one
+// opcode later. The irq bit is only set here, never cleared: after sei it
+// stays set until the irq is taken, also when the opcodes are run one by one
+// with processcommand.
+//
+__attribute((always_inline)) static inline void loadsignals(struct microprocessor *cpu)
+{
+    if (!(cpu->signals & SIGNAL_DELAY) && cpu->irqlines && !(cpu->status & 0x04)) cpu->signals |= SIGNAL_IRQ;
+}
+
+//
+// Opcodes that can change the pc to anywhere else: branches, jumps, calls,
+// returns and brk. They end a basic block.
+//
+__attribute((always_inline)) static inline int endsblock(unsigned char command)
+{
+    return (command & 0x1F) == 0x10 || command == 0x00 || command == 0x20 || 
+           command == 0x40 || command == 0x4C || command == 0x60 || command == 0x6C;
+}
+
+//
+// Write handler of the RAM pages holding decoded code. The write goes to the
+// memory of the page, as before the page was protected, and invalidates the 
+// blocks of the page when it hits a decoded byte. The page is then mapped 
+// back as plain RAM until code is decoded from it again.
+//
+static void codewrite(void *context, unsigned short address, unsigned char value)
+{
+    struct microprocessor *cpu = context;
+    struct blockcache *cache = cpu->blocks;
+    unsigned char page = address >> 8;
+    int i;
+
+    cache->memory[page][address & 0xFF] = value;
+    if (!(cache->code[address >> 3] & (1 << (address & 7)))) return;
+    cache->generation[page]++;
+    for (i = 0; i < 32; i++) cache->code[(page << 5) + i] = 0;
+    cpu->bus.writepage[page] = cache->memory[page];
+    cpu->bus.io[page] = cache->io[page];
+    cache->memory[page] = 0;
+    cpu->breakblock = 1;
+    cache->invalidations++;
+}
+
+//
+// Route the writes to a RAM page through codewrite. Pages whose writes do not
+// go to the memory the cpu reads (ROM, I/O) can not change the code, and are 
+// left alone.
+//
+static void protectpage(struct microprocessor *cpu, struct blockcache *cache, unsigned char page)
+{
+    if (cache->memory[page] || !cpu->bus.readpage[page]) return;
+    if (cpu->bus.writepage[page] != cpu->bus.readpage[page]) return;
+    cache->memory[page] = cpu->bus.writepage[page];
+    cache->io[page] = cpu->bus.io[page];
+    cpu->bus.writepage[page] = 0;
+    cpu->bus.io[page].write = codewrite;
+    cpu->bus.io[page].context = cpu;
+}
+
+//
+// Decode the block starting at pc into its cache entry. The block stops at 
+// the first opcode ending a block, after BLOCK_OPS opcodes, or before an 
+// opcode with a byte on an I/O page, which are never cached. Returns NULL if
+// the first opcode is already on an I/O page.
+//
+__attribute((noinline)) static struct block *decodeblock(struct microprocessor *cpu, struct block *block, unsigned short pc)
+{
+    struct blockcache *cache = cpu->blocks;
+    struct blockop *op;
+    unsigned char bytes[3];
+    unsigned short address = pc, last = pc;
+    unsigned char *page;
+    int count = 0, cycles = 0, i, n;
+
+    while (count < BLOCK_OPS) {
+        page = cpu->bus.readpage[address >> 8];
+        if (!page) break;
+        bytes[0] = page[address & 0xFF];
+        n = opcodeinfo[bytes[0]].flags & OPCODE_SIZE;
+        for (i = 1; i < n; i++) {
+            page = cpu->bus.readpage[(unsigned short) (address + i) >> 8];
+            if (!page) break;
+            bytes[i] = page[(address + i) & 0xFF];
+        }
+        if (i < n) break;
+        op = &block->op[count++];
+        op->opcode = bytes[0];
+        op->cycles = opcodeinfo[bytes[0]].cycles;
+        op->operand = n == 3 ? bytes[1] | bytes[2] << 8 : bytes[1];
+        op->next = (unsigned short) (address + n);
+        cycles += op->cycles;
+        for (i = 0; i < n; i++) {
+            last = (unsigned short) (address + i);
+            cache->code[last >> 3] |= 1 << (last & 7);
+            protectpage(cpu, cache, last >> 8);
+        }
+        address = op->next;
+        if (endsblock(bytes[0])) break;
+    }
+    block->count = count;
+    if (!count) return 0;
+    block->pc = pc;
+    block->page[0] = pc >> 8;
+    block->page[1] = last >> 8;
+    block->generation[0] = cache->generation[block->page[0]];
+    block->generation[1] = cache->generation[block->page[1]];
+    // base cycles plus page crossings and taken branches, at most 2 per opcode
+    block->maxcycles = cycles + 2 * count;
+    block->runs = 0;
+    block->native = 0;
+    cache->misses++;
+    return block;
+}
+
+__attribute((always_inline)) static inline struct block *findblock(struct microprocessor *cpu, struct blockcache *cache)
+{
+    struct block *block = &cache->blocks[cpu->pc & (BLOCK_ENTRIES - 1)];
+
+    if (block->pc == cpu->pc && block->count &&
+        block->generation[0] == cache->generation[block->page[0]] &&
+        block->generation[1] == cache->generation[block->page[1]]) {
+        cache->hits++;
+        return block;
+    }
+    return decodeblock(cpu, block, cpu->pc);
+}
+
+//
+// Operands of a decoded opcode, used by runblocks and the JIT helpers below.
+// The pc is still moved past the operand, so the bodies see it as usual.
+//
+#undef OPERAND8
+#undef OPERAND16
+#define OPERAND8 ((unsigned char) (cpu->pc = op->next, op->operand))
+#define OPERAND16 (cpu->pc = op->next, op->operand)
+
+#ifdef JIT
+//
+// JIT compiler. A block run JIT_THRESHOLD times is compiled to x86-64 code in
+// the buffer set with setjit. The compiled block keeps A, X, Y and the status
+// register in host registers, accumulates the base cycles and only writes
+// them back to the cpu context when it calls C code or returns. The common
+// opcodes are compiled inline. The others (stack, calls and returns, brk,
+// cli, indirect jmp and all undocumented opcodes) call a helper running the
+// body from opcodes.h, so the diagnostics and the interrupt lines work as in
+// the interpreter.
+//
+// Memory is accessed through the page tables of the bus. A page without a
+// direct pointer (I/O, protected code, ROM writes) goes through readmemory or
+// writememory from C, with the pc set as the interpreter would have it. After
+// such a call the block returns early if breakblock is set (a write to code,
+// an interrupt, a change on the interrupt lines or stoprun from a handler). A compiled block returns the
+// number of opcodes it ran, and leaves the pc at the next opcode.
+//
+#define JIT_THRESHOLD 64
+#define JIT_BLOCKSIZE 16384         // room left in the buffer to compile a block
+
+//
+// Helpers called by the compiled code. jit_<opcode> runs the body of an
+// opcode the compiler does not inline, on its decoded operand.
+//
+#define OPCODE(code, body) \
+static void jit_##code(struct microprocessor *cpu, struct blockop *op) \
+{ \
+    unsigned char command = code; \
+    (void) command; \
+    cpu->bordercross = 0; \
+    body; \
+    pagepenalty(cpu, code); \
+}
+#include "opcodes.h"
+#undef OPCODE
+
+static void (*const jithelper[256])(struct microprocessor *cpu, struct blockop *op) = {
+#define OPCODE(code, body) [code] = jit_##code,
+#include "opcodes.h"
+#undef OPCODE
+};
+
+static unsigned char jitread(struct microprocessor *cpu, unsigned short address)
+{
+    return readmemory(cpu, address);
+}
+
+static void jitwrite(struct microprocessor *cpu, unsigned short address, unsigned char value)
+{
+    writememory(cpu, address, value);
+}
+
+static void jitadc(struct microprocessor *cpu, unsigned char operand)
+{
+    adc(cpu, operand);
+}
+
+static void jitsbc(struct microprocessor *cpu, unsigned char operand)
+{
+    sbc(cpu, operand);
+}
+
+//
+// Host registers. The compiled code pins the cpu context in r15, the nztable
+// in rbx, A, X and Y in r12, r13 and r14 and the status register in rbp, all
+// callee saved, so they survive the calls to C. rax, rcx, rdx and r8 are
+// scratch, and so are three dwords on the stack: [rsp] holds the address of
+// read-modify-write opcodes, [rsp+8] the page crossing of indexed reads and
+// [rsp+12] a byte kept across a call.
+//
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+#define NOINDEX -1
+
+// condition codes of jcc and setcc
+#define CC_O  0x0
+#define CC_C  0x2
+#define CC_NC 0x3
+#define CC_Z  0x4
+#define CC_NZ 0x5
+#define CC_A  0x7
+
+#define CPU(field) ((int) offsetof(struct microprocessor, field))
+
+struct jit {
+    unsigned char *code;
+    unsigned long size;
+    unsigned long epilogue;         // offset of the code returning to C
+};
+
+static void emitbyte(struct jit *j, int value)
+{
+    j->code[j->size++] = value;
+}
+
+static void emitimm(struct jit *j, unsigned long value, int bytes)
+{
+    while (bytes--) {
+        emitbyte(j, value & 0xFF);
+        value >>= 8;
+    }
+}
+
+//
+// Operand size (1, 2, 4 or 8 bytes) and REX prefixes. Byte operations on
+// registers 4 to 7 need a REX prefix to use spl, bpl, sil and dil instead of
+// ah, ch, dh and bh.
+//
+static void emitprefix(struct jit *j, int size, int opcode, int reg, int index, int base, int bytereg)
+{
+    int rex = 0x40 | (size == 8) << 3 | (reg >> 3 & 1) << 2 | (index > 0 ? index >> 3 & 1 : 0) << 1 | (base >> 3 & 1);
+
+    if (size == 2) emitbyte(j, 0x66);
+    if (rex != 0x40 || (bytereg >= 4 && bytereg <= 7)) emitbyte(j, rex);
+    if (opcode > 0xFF) emitbyte(j, opcode >> 8);
+    emitbyte(j, opcode & 0xFF);
+}
+
+//
+// Opcode with a register operand and a memory operand [base + index*scale
+// + disp]. For the group opcodes reg is the opcode extension.
+//
+static void emitmem(struct jit *j, int size, int opcode, int reg, int base, int index, int scale, int disp)
+{
+    int mod = disp == 0 && (base & 7) != RBP ? 0 : disp >= -128 && disp < 128 ? 1 : 2;
+
+    emitprefix(j, size, opcode, reg, index, base, size == 1 ? reg : 0);
+    if (index >= 0 || (base & 7) == RSP) {
+        emitbyte(j, mod << 6 | (reg & 7) << 3 | 4);
+        emitbyte(j, (scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0) << 6 | ((index >= 0 ? index : RSP) & 7) << 3 | (base & 7));
+    }
+    else emitbyte(j, mod << 6 | (reg & 7) << 3 | (base & 7));
+    if (mod == 1) emitbyte(j, disp & 0xFF);
+    if (mod == 2) emitimm(j, disp, 4);
+}
+
+//
+// Opcode with two register operands
+//
+static void emitreg(struct jit *j, int size, int opcode, int reg, int rm)
+{
+    emitprefix(j, size, opcode, reg, NOINDEX, rm, size == 1 ? (rm >= 4 && rm <= 7 ? rm : reg) : 0);
+    emitbyte(j, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+//
+// add, or, and, sub, cmp... (opcode extension op) of a register and an
+// immediate value
+//
+static void emitalu(struct jit *j, int size, int op, int reg, int value)
+{
+    if (size == 1) {
+        emitreg(j, 1, 0x80, op, reg);
+        emitbyte(j, value);
+    }
+    else if (value >= -128 && value < 128) {
+        emitreg(j, size, 0x83, op, reg);
+        emitbyte(j, value);
+    }
+    else {
+        emitreg(j, size, 0x81, op, reg);
+        emitimm(j, value, 4);
+    }
+}
+
+static void emitmovimm(struct jit *j, int reg, unsigned int value)
+{
+    if (reg >= 8) emitbyte(j, 0x41);
+    emitbyte(j, 0xB8 + (reg & 7));
+    emitimm(j, value, 4);
+}
+
+static void emitshift(struct jit *j, int op, int reg, int count)
+{
+    emitreg(j, 4, 0xC1, op, reg);
+    emitbyte(j, count);
+}
+
+//
+// Jumps. A forward jump returns the offset of its displacement, which is set
+// by patch once the target is emitted.
+//
+static unsigned long emitjcc(struct jit *j, int cc)
+{
+    emitbyte(j, 0x0F);
+    emitbyte(j, 0x80 | cc);
+    emitimm(j, 0, 4);
+    return j->size - 4;
+}
+
+static unsigned long emitjmp(struct jit *j)
+{
+    emitbyte(j, 0xE9);
+    emitimm(j, 0, 4);
+    return j->size - 4;
+}
+
+static void patch(struct jit *j, unsigned long jump)
+{
+    unsigned int disp = j->size - (jump + 4);
+    j->code[jump] = disp;
+    j->code[jump + 1] = disp >> 8;
+    j->code[jump + 2] = disp >> 16;
+    j->code[jump + 3] = disp >> 24;
+}
+
+static void emitcall(struct jit *j, void *function)
+{
+    emitbyte(j, 0x48);
+    emitbyte(j, 0xB8);
+    emitimm(j, (unsigned long) function, 8);
+    emitreg(j, 4, 0xFF, 2, RAX);
+}
+
+//
+// Write the pinned registers back to the cpu context, and read them again
+//
+static void emitspill(struct jit *j)
+{
+    emitmem(j, 1, 0x88, R12, R15, NOINDEX, 1, CPU(a));
+    emitmem(j, 1, 0x88, R13, R15, NOINDEX, 1, CPU(x));
+    emitmem(j, 1, 0x88, R14, R15, NOINDEX, 1, CPU(y));
+    emitmem(j, 1, 0x88, RBP, R15, NOINDEX, 1, CPU(status));
+}
+
+static void emitreload(struct jit *j)
+{
+    emitmem(j, 4, 0x0FB6, R12, R15, NOINDEX, 1, CPU(a));
+    emitmem(j, 4, 0x0FB6, R13, R15, NOINDEX, 1, CPU(x));
+    emitmem(j, 4, 0x0FB6, R14, R15, NOINDEX, 1, CPU(y));
+    emitmem(j, 4, 0x0FB6, RBP, R15, NOINDEX, 1, CPU(status));
+}
+
+static void emitstorepc(struct jit *j, unsigned short pc)
+{
+    emitmem(j, 2, 0xC7, 0, R15, NOINDEX, 1, CPU(pc));
+    emitimm(j, pc, 2);
+}
+
+static void emitcycles(struct jit *j, int cycles)
+{
+    if (!cycles) return;
+    emitmem(j, 8, 0x81, 0, R15, NOINDEX, 1, CPU(cycles));
+    emitimm(j, cycles, 4);
+}
+
+//
+// Return count opcodes run, the pc must already be set
+//
+static void emitexit(struct jit *j, int count)
+{
+    emitmovimm(j, RAX, count);
+    emitbyte(j, 0xE9);
+    emitimm(j, j->epilogue - (j->size + 4), 4);
+}
+
+//
+// Return count opcodes run if a call to C set breakblock
+//
+static void emitbreak(struct jit *j, int count)
+{
+    unsigned long skip;
+
+    emitmem(j, 1, 0x80, 7, R15, NOINDEX, 1, CPU(breakblock));
+    emitbyte(j, 0);
+    skip = emitjcc(j, CC_Z);
+    emitexit(j, count);
+    patch(j, skip);
+}
+
+//
+// N and Z flags of the byte in reg, from the nztable
+//
+static void emitsetnz(struct jit *j, int reg)
+{
+    emitmem(j, 4, 0x0FB6, RAX, RBX, reg, 1, 0);
+    emitalu(j, 4, 4, RBP, 0x7D);
+    emitreg(j, 4, 0x0B, RBP, RAX);
+}
+
+//
+// Read the byte at the address in eax into ecx. Pages without a direct
+// pointer call readmemory, with the pc past the operand.
+//
+static void emitread(struct jit *j, unsigned short next)
+{
+    unsigned long slow, done;
+
+    emitreg(j, 4, 0x8B, RCX, RAX);
+    emitshift(j, 5, RCX, 8);
+    emitmem(j, 8, 0x8B, RDX, R15, RCX, 8, CPU(bus.readpage));
+    emitreg(j, 8, 0x85, RDX, RDX);
+    slow = emitjcc(j, CC_Z);
+    emitreg(j, 4, 0x0FB6, RCX, RAX);
+    emitmem(j, 4, 0x0FB6, RCX, RDX, RCX, 1, 0);
+    done = emitjmp(j);
+    patch(j, slow);
+    emitstorepc(j, next);
+    emitspill(j);
+    emitreg(j, 8, 0x8B, RDI, R15);
+    emitreg(j, 4, 0x8B, RSI, RAX);
+    emitcall(j, jitread);
+    emitreg(j, 4, 0x0FB6, RCX, RAX);
+    emitreload(j);
+    patch(j, done);
+}
+
+//
+// Write the byte in r8d to the address in eax. r8d is kept across the call.
+//
+static void emitwrite(struct jit *j, unsigned short next)
+{
+    unsigned long slow, done;
+
+    emitreg(j, 4, 0x8B, RCX, RAX);
+    emitshift(j, 5, RCX, 8);
+    emitmem(j, 8, 0x8B, RDX, R15, RCX, 8, CPU(bus.writepage));
+    emitreg(j, 8, 0x85, RDX, RDX);
+    slow = emitjcc(j, CC_Z);
+    emitreg(j, 4, 0x0FB6, RCX, RAX);
+    emitmem(j, 1, 0x88, R8, RDX, RCX, 1, 0);
+    done = emitjmp(j);
+    patch(j, slow);
+    emitmem(j, 4, 0x89, R8, RSP, NOINDEX, 1, 12);
+    emitstorepc(j, next);
+    emitspill(j);
+    emitreg(j, 8, 0x8B, RDI, R15);
+    emitreg(j, 4, 0x8B, RSI, RAX);
+    emitreg(j, 4, 0x8B, RDX, R8);
+    emitcall(j, jitwrite);
+    emitmem(j, 4, 0x8B, R8, RSP, NOINDEX, 1, 12);
+    emitreload(j);
+    patch(j, done);
+}
+
+//
+// Address referenced by op into eax. With penalty, [rsp+8] is set to 1 when
+// the index crosses a page (ABX, ABY and IZY reads).
+//
+static void emitaddress(struct jit *j, int mode, struct blockop *op, int penalty)
+{
+    int index = mode == MODE_ZPX || mode == MODE_ABX ? R13 : R14;
+
+    switch (mode) {
+    case MODE_ZP:
+    case MODE_ABS:
+        emitmovimm(j, RAX, op->operand);
+        break;
+    case MODE_ZPX:
+    case MODE_ZPY:
+        emitmem(j, 4, 0x8D, RAX, index, NOINDEX, 1, op->operand);
+        emitreg(j, 4, 0x0FB6, RAX, RAX);
+        break;
+    case MODE_ABX:
+    case MODE_ABY:
+        if (penalty) {
+            emitalu(j, 4, 7, index, 0xFF - (op->operand & 0xFF));
+            emitmem(j, 1, 0x0F90 | CC_A, 0, RSP, NOINDEX, 1, 8);
+        }
+        emitmem(j, 4, 0x8D, RAX, index, NOINDEX, 1, op->operand);
+        emitreg(j, 4, 0x0FB7, RAX, RAX);
+        break;
+    case MODE_IZX:
+        emitmem(j, 4, 0x8D, RAX, R13, NOINDEX, 1, op->operand);
+        emitreg(j, 4, 0x0FB6, RAX, RAX);
+        emitmem(j, 4, 0x89, RAX, RSP, NOINDEX, 1, 0);
+        emitread(j, op->next);
+        emitmem(j, 4, 0x89, RCX, RSP, NOINDEX, 1, 12);
+        emitmem(j, 4, 0x8B, RAX, RSP, NOINDEX, 1, 0);
+        emitalu(j, 1, 0, RAX, 1);
+        emitread(j, op->next);
+        emitshift(j, 4, RCX, 8);
+        emitmem(j, 4, 0x0B, RCX, RSP, NOINDEX, 1, 12);
+        emitreg(j, 4, 0x8B, RAX, RCX);
+        break;
+    case MODE_IZY:
+        emitmovimm(j, RAX, op->operand);
+        emitread(j, op->next);
+        emitmem(j, 4, 0x89, RCX, RSP, NOINDEX, 1, 12);
+        emitmovimm(j, RAX, (op->operand + 1) & 0xFF);
+        emitread(j, op->next);
+        emitshift(j, 4, RCX, 8);
+        emitmem(j, 4, 0x0B, RCX, RSP, NOINDEX, 1, 12);
+        if (penalty) {
+            emitmem(j, 4, 0x8B, RAX, RSP, NOINDEX, 1, 12);
+            emitreg(j, 4, 0x03, RAX, R14);
+            emitalu(j, 4, 7, RAX, 0xFF);
+            emitmem(j, 1, 0x0F90 | CC_A, 0, RSP, NOINDEX, 1, 8);
+        }
+        emitmem(j, 4, 0x8D, RAX, RCX, R14, 1, 0);
+        emitreg(j, 4, 0x0FB7, RAX, RAX);
+        break;
+    }
+}
+
+//
+// Shift or rotate the byte in ecx into r8d, setting the carry
+//
+static void emitshiftop(struct jit *j, int kind)
+{
+    switch (kind) {
+    case KIND_ASL:
+    case KIND_ROL:
+        emitreg(j, 4, 0x8B, R8, RCX);
+        emitshift(j, 4, R8, 1);
+        if (kind == KIND_ROL) {
+            emitreg(j, 4, 0x8B, RAX, RBP);
+            emitalu(j, 4, 4, RAX, 1);
+            emitreg(j, 4, 0x0B, R8, RAX);
+        }
+        emitalu(j, 4, 4, RBP, 0xFE);
+        emitreg(j, 4, 0x8B, RAX, R8);
+        emitshift(j, 5, RAX, 8);
+        emitreg(j, 4, 0x0B, RBP, RAX);
+        emitreg(j, 4, 0x0FB6, R8, R8);
+        break;
+    case KIND_LSR:
+    case KIND_ROR:
+        emitreg(j, 4, 0x8B, R8, RCX);
+        if (kind == KIND_ROR) {
+            emitreg(j, 4, 0x8B, RAX, RBP);
+            emitalu(j, 4, 4, RAX, 1);
+            emitshift(j, 4, RAX, 8);
+            emitreg(j, 4, 0x0B, R8, RAX);
+        }
+        emitalu(j, 4, 4, RBP, 0xFE);
+        emitreg(j, 4, 0x8B, RAX, RCX);
+        emitalu(j, 4, 4, RAX, 1);
+        emitreg(j, 4, 0x0B, RBP, RAX);
+        emitshift(j, 5, R8, 1);
+        break;
+    }
+}
+
+//
+// Binary adc or sbc of the byte in ecx, straight from the host flags. In
+// decimal mode the C handler is called instead.
+//
+static void emitadd(struct jit *j, int kind)
+{
+    unsigned long binary, done;
+
+    emitreg(j, 4, 0xF7, 0, RBP);
+    emitimm(j, 0x08, 4);
+    binary = emitjcc(j, CC_Z);
+    emitspill(j);
+    emitreg(j, 8, 0x8B, RDI, R15);
+    emitreg(j, 4, 0x8B, RSI, RCX);
+    emitcall(j, kind == KIND_ADC ? (void *) jitadc : (void *) jitsbc);
+    emitreload(j);
+    done = emitjmp(j);
+    patch(j, binary);
+    emitreg(j, 4, 0x33, RAX, RAX);
+    emitreg(j, 4, 0x33, RDX, RDX);
+    emitreg(j, 4, 0x0FBA, 4, RBP);
+    emitbyte(j, 0);
+    if (kind == KIND_ADC) {
+        emitreg(j, 1, 0x12, R12, RCX);
+        emitreg(j, 1, 0x0F90 | CC_C, 0, RAX);
+    }
+    else {
+        emitbyte(j, 0xF5);
+        emitreg(j, 1, 0x1A, R12, RCX);
+        emitreg(j, 1, 0x0F90 | CC_NC, 0, RAX);
+    }
+    emitreg(j, 1, 0x0F90 | CC_O, 0, RDX);
+    emitalu(j, 4, 4, RBP, 0x3C);
+    emitreg(j, 4, 0x0B, RBP, RAX);
+    emitshift(j, 4, RDX, 6);
+    emitreg(j, 4, 0x0B, RBP, RDX);
+    emitsetnz(j, R12);
+    patch(j, done);
+}
+
+//
+// Compile block into the JIT buffer. When the buffer is full, all the
+// compiled blocks are dropped and the buffer is filled again from the start.
+//
+__attribute((noinline)) static void jitcompile(struct microprocessor *cpu, struct block *block)
+{
+    static const unsigned char branchflag[4] = { 0x80, 0x40, 0x01, 0x02 };
+    struct blockcache *cache = cpu->blocks;
+    struct blockop *op;
+    struct jit jit, *j = &jit;
+    unsigned long body, skip;
+    unsigned short pc = block->pc, target;
+    int i, kind, mode, reg, pending = 0, slow, last;
+
+    if (cache->jitsize - cache->jitused < JIT_BLOCKSIZE) {
+        for (i = 0; i < BLOCK_ENTRIES; i++) cache->blocks[i].native = 0;
+        cache->jitused = 0;
+    }
+    j->code = cache->jitcode + cache->jitused;
+    j->size = 0;
+
+    // prologue and epilogue
+    emitbyte(j, 0x53);                      // push rbx
+    emitbyte(j, 0x55);                      // push rbp
+    emitbyte(j, 0x41); emitbyte(j, 0x54);   // push r12
+    emitbyte(j, 0x41); emitbyte(j, 0x55);   // push r13
+    emitbyte(j, 0x41); emitbyte(j, 0x56);   // push r14
+    emitbyte(j, 0x41); emitbyte(j, 0x57);   // push r15
+    emitalu(j, 8, 5, RSP, 24);
+    emitreg(j, 8, 0x8B, R15, RDI);
+    emitbyte(j, 0x48); emitbyte(j, 0xBB);   // mov rbx, nztable
+    emitimm(j, (unsigned long) nztable, 8);
+    emitreload(j);
+    body = emitjmp(j);
+    j->epilogue = j->size;
+    emitspill(j);
+    emitalu(j, 8, 0, RSP, 24);
+    emitbyte(j, 0x41); emitbyte(j, 0x5F);   // pop r15
+    emitbyte(j, 0x41); emitbyte(j, 0x5E);   // pop r14
+    emitbyte(j, 0x41); emitbyte(j, 0x5D);   // pop r13
+    emitbyte(j, 0x41); emitbyte(j, 0x5C);   // pop r12
+    emitbyte(j, 0x5D);                      // pop rbp
+    emitbyte(j, 0x5B);                      // pop rbx
+    emitbyte(j, 0xC3);                      // ret
+    patch(j, body);
+
+    for (i = 0; i < block->count; i++) {
+        op = &block->op[i];
+        kind = opkind[op->opcode];
+        mode = opcodeinfo[op->opcode].mode;
+        last = i == block->count - 1;
+        slow = mode >= MODE_ZP;
+        pending += op->cycles;
+
+        if (kind == KIND_HELPER) {
+            emitcycles(j, pending);
+            pending = 0;
+            emitstorepc(j, pc + 1);
+            emitspill(j);
+            emitreg(j, 8, 0x8B, RDI, R15);
+            emitbyte(j, 0x48); emitbyte(j, 0xBE);   // mov rsi, op
+            emitimm(j, (unsigned long) op, 8);
+            emitcall(j, jithelper[op->opcode]);
+            emitreload(j);
+            if (last) emitexit(j, i + 1);
+            else emitbreak(j, i + 1);
+            pc = op->next;
+            continue;
+        }
+        if (kind == KIND_BRANCH) {
+            emitcycles(j, pending);
+            pending = 0;
+            target = op->next + (signed char) op->operand;
+            emitreg(j, 4, 0xF7, 0, RBP);
+            emitimm(j, branchflag[op->opcode >> 6], 4);
+            skip = emitjcc(j, op->opcode & 0x20 ? CC_Z : CC_NZ);
+            emitcycles(j, (target & 0xFF00) != (op->next & 0xFF00) ? 2 : 1);
+            emitstorepc(j, target);
+            emitexit(j, i + 1);
+            patch(j, skip);
+            emitstorepc(j, op->next);
+            emitexit(j, i + 1);
+            break;
+        }
+        if (kind == KIND_JMP) {
+            emitcycles(j, pending);
+            emitstorepc(j, op->operand);
+            emitexit(j, i + 1);
+            break;
+        }
+
+        // the cycles are flushed before a possible call to C
+        if (slow) {
+            emitcycles(j, pending);
+            pending = 0;
+        }
+        if (mode != MODE_IMP && mode != MODE_IMM)
+            emitaddress(j, mode, op, opcodeinfo[op->opcode].flags & OPCODE_PENALTY);
+
+        switch (kind) {
+        case KIND_LDA: case KIND_LDX: case KIND_LDY:
+        case KIND_AND: case KIND_ORA: case KIND_EOR:
+        case KIND_CMP: case KIND_CPX: case KIND_CPY:
+        case KIND_BIT: case KIND_ADC: case KIND_SBC:
+            if (mode == MODE_IMM) emitmovimm(j, RCX, op->operand & 0xFF);
+            else emitread(j, op->next);
+            reg = kind == KIND_LDX || kind == KIND_CPX ? R13 : kind == KIND_LDY || kind == KIND_CPY ? R14 : R12;
+            if (kind <= KIND_LDY) {
+                emitreg(j, 4, 0x8B, reg, RCX);
+                emitsetnz(j, reg);
+            }
+            else if (kind <= KIND_EOR) {
+                emitreg(j, 4, kind == KIND_AND ? 0x23 : kind == KIND_ORA ? 0x0B : 0x33, R12, RCX);
+                emitsetnz(j, R12);
+            }
+            else if (kind <= KIND_CPY) {
+                emitreg(j, 4, 0x33, RDX, RDX);
+                emitreg(j, 4, 0x8B, RAX, reg);
+                emitreg(j, 1, 0x2A, RAX, RCX);
+                emitreg(j, 1, 0x0F90 | CC_NC, 0, RDX);
+                emitalu(j, 4, 4, RBP, 0x7C);
+                emitreg(j, 4, 0x0B, RBP, RDX);
+                emitsetnz(j, RAX);
+            }
+            else if (kind == KIND_BIT) {
+                emitalu(j, 4, 4, RBP, 0x3D);
+                emitreg(j, 4, 0x8B, RAX, RCX);
+                emitalu(j, 4, 4, RAX, 0xC0);
+                emitreg(j, 4, 0x0B, RBP, RAX);
+                emitreg(j, 4, 0x8B, RAX, RCX);
+                emitreg(j, 4, 0x23, RAX, R12);
+                emitmem(j, 4, 0x0FB6, RAX, RBX, RAX, 1, 0);
+                emitalu(j, 4, 4, RAX, 0x02);
+                emitreg(j, 4, 0x0B, RBP, RAX);
+            }
+            else emitadd(j, kind);
+            if (mode == MODE_ABX || mode == MODE_ABY || mode == MODE_IZY) {
+                emitmem(j, 4, 0x0FB6, RCX, RSP, NOINDEX, 1, 8);
+                emitmem(j, 8, 0x01, RCX, R15, NOINDEX, 1, CPU(cycles));
+            }
+            break;
+        case KIND_STA: case KIND_STX: case KIND_STY:
+            emitreg(j, 4, 0x8B, R8, kind == KIND_STA ? R12 : kind == KIND_STX ? R13 : R14);
+            emitwrite(j, op->next);
+            break;
+        case KIND_INC: case KIND_DEC:
+        case KIND_ASL: case KIND_LSR: case KIND_ROL: case KIND_ROR:
+            if (mode == MODE_IMP) {
+                emitreg(j, 4, 0x8B, RCX, R12);
+                emitshiftop(j, kind);
+                emitreg(j, 4, 0x8B, R12, R8);
+                emitsetnz(j, R12);
+                break;
+            }
+            emitmem(j, 4, 0x89, RAX, RSP, NOINDEX, 1, 0);
+            emitread(j, op->next);
+            if (kind == KIND_INC || kind == KIND_DEC) {
+                emitmem(j, 4, 0x8D, R8, RCX, NOINDEX, 1, kind == KIND_INC ? 1 : -1);
+                emitreg(j, 4, 0x0FB6, R8, R8);
+            }
+            else emitshiftop(j, kind);
+            emitmem(j, 4, 0x8B, RAX, RSP, NOINDEX, 1, 0);
+            emitwrite(j, op->next);
+            emitsetnz(j, R8);
+            break;
+        case KIND_INX: case KIND_INY: case KIND_DEX: case KIND_DEY:
+            reg = kind == KIND_INX || kind == KIND_DEX ? R13 : R14;
+            emitalu(j, 1, kind == KIND_INX || kind == KIND_INY ? 0 : 5, reg, 1);
+            emitsetnz(j, reg);
+            break;
+        case KIND_TAX: case KIND_TAY: case KIND_TXA: case KIND_TYA:
+            reg = kind == KIND_TAX ? R13 : kind == KIND_TAY ? R14 : R12;
+            emitreg(j, 4, 0x8B, reg, kind == KIND_TXA ? R13 : kind == KIND_TYA ? R14 : R12);
+            emitsetnz(j, reg);
+            break;
+        case KIND_TSX:
+            emitmem(j, 4, 0x0FB6, R13, R15, NOINDEX, 1, CPU(sp));
+            emitsetnz(j, R13);
+            break;
+        case KIND_TXS:
+            emitmem(j, 1, 0x88, R13, R15, NOINDEX, 1, CPU(sp));
+            break;
+        case KIND_CLC: emitalu(j, 4, 4, RBP, 0xFE); break;
+        case KIND_SEC: emitalu(j, 4, 1, RBP, 0x01); break;
+        case KIND_SEI: emitalu(j, 4, 1, RBP, 0x04); break;
+        case KIND_CLD: emitalu(j, 4, 4, RBP, 0xF7); break;
+        case KIND_SED: emitalu(j, 4, 1, RBP, 0x08); break;
+        case KIND_CLV: emitalu(j, 4, 4, RBP, 0xBF); break;
+        case KIND_NOP: break;
+        }
+        if (slow) emitbreak(j, i + 1);
+        if (last) {
+            emitcycles(j, pending);
+            emitstorepc(j, op->next);
+            emitexit(j, i + 1);
+        }
+        pc = op->next;
+    }
+
+    block->native = (nativeblock) (void *) j->code;
+    cache->jitused += (j->size + 15) & ~15UL;
+    cache->compiled++;
+}
+#endif
+
+//
+// Run loop of the block cache, used by run() when a cache is set. Runs whole
+// decoded blocks, with the same stop conditions as the other run loops 
+// checked after each opcode. The operands come from the decoded opcode, the 
+// pc is still moved past them so the bodies see it as usual. A block is left
+// early when one of its opcodes writes to decoded code or an interrupt is 
+// taken or the interrupt lines change. Opcodes on I/O pages are executed 
+// one by one without the cache.
+// A block compiled by the JIT runs in a single call instead, when the whole
+// block fits in the cycles and opcodes left and the trace and the profile 
+// are off.
+//
+__attribute((noinline)) static unsigned long runblocks(struct microprocessor *cpu, unsigned long count)
+{
+    struct blockcache *cache = cpu->blocks;
+    struct block *block;
+    struct blockop *op, *end;
+    unsigned long executed = 0;
+    unsigned short pc;
+    unsigned char command;
+
+    while (cpu->cycles < cpu->deadline && executed < count) {
+        if (cpu->signals) pollsignals(cpu);
+        // an irq waiting for the opcode after cli or plp is taken after it, 
+        // so that opcode runs alone
+        block = cpu->signals ? 0 : findblock(cpu, cache);
+        if (!block) {
+            execute(cpu);
+            executed++;
+            continue;
+        }
+#ifdef JIT
+        if (!block->native && cache->jitcode && ++block->runs >= JIT_THRESHOLD) jitcompile(cpu, block);
+        if (block->native && !cpu->trace.records && !cpu->profile && cpu->cycles + block->maxcycles < cpu->deadline &&
+            count - executed >= block->count) {
+            cpu->breakblock = 0;
+            executed += block->native(cpu);
+            continue;
+        }
+#endif
+        cpu->breakblock = 0;
+        pc = block->pc;
+        op = block->op;
+        end = op + (count - executed < block->count ? count - executed : block->count);
+        while (op < end) {
+            cpu->bordercross = 0;
+            cpu->pc = pc + 1;
+            cpu->cycles += op->cycles;
+            command = op->opcode;
+            switch (command)
+            {
+#define OPCODE(code, body) case code: body; pagepenalty(cpu, code); break;
+#include "opcodes.h"
+#undef OPCODE
+            }
+            traceopcode(cpu, pc, command);
+            executed++;
+            if (cpu->breakblock || cpu->cycles >= cpu->deadline) break;
+            pc = op->next;
+            op++;
+        }
+    }
+    return executed;
+}
+
+#undef OPERAND8
+#undef OPERAND16
+#define OPERAND8 fetchmemory(cpu)
+#define OPERAND16 fetchword(cpu)
+
+//
+// Event queue of the scheduler, a binary heap in cpu->events.heap where each
+// event is due no later than its two children (at 2i+1 and 2i+2). 
+//
+static void siftup(struct scheduler *events, unsigned int i)
+{
+    struct event event = events->heap[i];
+
+    while (i > 0 && events->heap[(i - 1) / 2].when > event.when) {
+        events->heap[i] = events->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    events->heap[i] = event;
+}
+
+static void siftdown(struct scheduler *events, unsigned int i)
+{
+    struct event event = events->heap[i];
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < events->count) {
+        if (child + 1 < events->count && events->heap[child + 1].when < events->heap[child].when) child++;
+        if (events->heap[child].when >= event.when) break;
+        events->heap[i] = events->heap[child];
+        i = child;
+    }
+    events->heap[i] = event;
+}
+
+//
+// Call the handlers of the events due, earliest first. Each event is taken
+// out of the queue before its handler is called, so the handler can schedule
+// it again, e.g. at when plus the period of a timer. Called between opcodes
+// with cpu->status up to date.
+//
+__attribute((noinline)) static void fireevents(struct microprocessor *cpu)
+{
+    struct scheduler *events = &cpu->events;
+    struct event event;
+
+    while (events->count && events->heap[0].when <= cpu->cycles) {
+        event = events->heap[0];
+        events->heap[0] = events->heap[--events->count];
+        siftdown(events, 0);
+        event.handler(event.context, event.when);
+    }
+    events->next = events->count ? events->heap[0].when : ULONG_MAX;
+}
+
+//
+// Execute a single opcode, after the events due
+//
+int processcommand(struct microprocessor *cpu)
+{
+    if (cpu->cycles >= cpu->events.next) fireevents(cpu);
+    loadflags(cpu);
+    loadsignals(cpu);
+    if (cpu->signals) pollsignals(cpu);
+    if (cpu->exact) exactexecute(cpu);
+    else execute(cpu);
+    storeflags(cpu);
+    return 0;
+}
+
+//
+// Run loop shared by runcycles and runinstructions. Executes opcodes until
+// cpu->cycles reaches the deadline, count opcodes were executed or stoprun 
+// is called. The run is cut in stretches ending at the next event of the 
+// scheduler, whose handlers are called between two stretches, so the inner
+// loops only test cpu->deadline, which is the end of the current stretch. 
+// stoprun clears it, so the loop only has one test on the cycle counter per
+// opcode besides the instruction count, and one on cpu->signals for the 
+// interrupt lines. The cycle exact engine and the block cache have loops of
+// their own.
+//
+// When built with THREADED_DISPATCH, each opcode body ends by fetching the
+// next opcode and jumping straight to its label through the dispatch table,
+// instead of going back to a single switch. Every opcode then has its own 
+// indirect jump, which the host branch predictor can learn (e.g. a cmp is 
+// usually followed by a branch). Hosts with a history based indirect branch
+// predictor already predict the single switch jump well, so measure both.
+//
+static struct runresult run(struct microprocessor *cpu, unsigned long deadline, unsigned long count)
+{
+    struct runresult result;
+    unsigned long start = cpu->cycles;
+    unsigned long executed = 0;
+
+    cpu->stopped = 0;
+    loadflags(cpu);
+    loadsignals(cpu);
+
+    while (!cpu->stopped && cpu->cycles < deadline && executed < count) {
+        if (cpu->cycles >= cpu->events.next) {
+            storeflags(cpu);
+            fireevents(cpu);
+            loadflags(cpu);
+            loadsignals(cpu);
+            continue;
+        }
+        cpu->deadline = cpu->events.next < deadline ? cpu->events.next : deadline;
+
+        if (cpu->exact) {
+            while (cpu->cycles < cpu->deadline && executed < count) {
+                if (cpu->signals) pollsignals(cpu);
+                exactexecute(cpu);
+                executed++;
+            }
+            continue;
+        }
+        if (cpu->blocks) {
+            executed += runblocks(cpu, count - executed);
+            continue;
+        }
+
+#ifdef THREADED_DISPATCH
+        static const void *dispatch[256] = {
+#define OPCODE(code, body) [code] = &&op_##code,
+#include "opcodes.h"
+#undef OPCODE
+        };
+        unsigned short pc;
+        unsigned char command;
+
+#define NEXT \
+    if (cpu->cycles >= cpu->deadline || executed >= count) continue; \
+    if (cpu->signals) pollsignals(cpu); \
+    cpu->bordercross = 0; \
+    pc = cpu->pc; \
+    command = fetchmemory(cpu); \
+    cpu->cycles += opcodeinfo[command].cycles; \
+    executed++; \
+    goto *dispatch[command]
+
+        NEXT;
+#define OPCODE(code, body) op_##code: body; pagepenalty(cpu, code); traceopcode(cpu, pc, command); NEXT;
+#include "opcodes.h"
+#undef OPCODE
+#undef NEXT
+#else
+        while (cpu->cycles < cpu->deadline && executed < count) {
+            if (cpu->signals) pollsignals(cpu);
+            execute(cpu);
+            executed++;
+        }
+#endif
+    }
+
+    storeflags(cpu);
+    result.cycles = cpu->cycles - start;
+    result.instructions = executed;
+    if (cpu->stopped) result.reason = STOP_REQUESTED;
+    else if (executed == count) result.reason = STOP_INSTRUCTIONS;
+    else result.reason = STOP_CYCLES;
+    return result;
+}
+
+//
+// Run opcodes until at least budget cycles were spent. The last opcode may 
+// overshoot the budget by a few cycles.
+//
+struct runresult runcycles(struct microprocessor *cpu, unsigned long budget)
+{
+    unsigned long deadline = cpu->cycles + budget;
+    if (deadline < cpu->cycles) deadline = ULONG_MAX;
+    return run(cpu, deadline, ULONG_MAX);
+}
+
+//
+// Run count opcodes
+//
+struct runresult runinstructions(struct microprocessor *cpu, unsigned long count)
+{
+    return run(cpu, ULONG_MAX, count);
+}
+
+//
+// Stop the current run loop after the opcode being executed. Meant to be 
+// called from the bus handlers. 
+//
+void stoprun(struct microprocessor *cpu)
+{
+    cpu->stopped = 1;
+    cpu->deadline = 0;
+    cpu->breakblock = 1;
+}
+
+//
+// Batch runner. Each worker thread has a queue of cpus (indexes in cpus), 
+// runs them round robin one slice at a time, and steals cpus from the end of
+// the other queues when its own is empty. A cpu being run is in no queue, 
+// and goes back to the queue of its worker after the slice unless it is done,
+// so a worker finding all the queues empty can stop: the cpus left are run by
+// the other workers.
+//
+struct batchqueue {
+#ifdef BATCH_THREADS
+    pthread_mutex_t lock;
+#endif
+    int *jobs;                      // ring of size batch count
+    int first;
+    int used;
+};
+
+struct batch {
+    struct microprocessor **cpus;
+    struct runresult *results;
+    int count;
+    unsigned long slice;
+    unsigned long budget;
+    struct batchqueue *queues;
+    int workers;
+};
+
+struct batchworker {
+    struct batch *batch;
+    int index;
+};
+
+static void lockqueue(struct batchqueue *queue)
+{
+#ifdef BATCH_THREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+}
+
+static void unlockqueue(struct batchqueue *queue)
+{
+#ifdef BATCH_THREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+}
+
+static void pushjob(struct batch *batch, struct batchqueue *queue, int job)
+{
+    lockqueue(queue);
+    queue->jobs[(queue->first + queue->used) % batch->count] = job;
+    queue->used++;
+    unlockqueue(queue);
+}
+
+//
+// Take the first job of the queue, or with steal the last one. Returns -1 if
+// the queue is empty.
+//
+static int takejob(struct batch *batch, struct batchqueue *queue, int steal)
+{
+    int job = -1;
+
+    lockqueue(queue);
+    if (queue->used && steal) job = queue->jobs[(queue->first + --queue->used) % batch->count];
+    else if (queue->used) {
+        job = queue->jobs[queue->first];
+        queue->first = (queue->first + 1) % batch->count;
+        queue->used--;
+    }
+    unlockqueue(queue);
+    return job;
+}
+
+static void *batchwork(void *context)
+{
+    struct batchworker *worker = context;
+    struct batch *batch = worker->batch;
+    struct batchqueue *own = &batch->queues[worker->index];
+    struct runresult result, *total;
+    unsigned long left;
+    int job, i;
+
+    for (;;) {
+        job = takejob(batch, own, 0);
+        for (i = 1; job < 0 && i < batch->workers; i++) {
+            job = takejob(batch, &batch->queues[(worker->index + i) % batch->workers], 1);
+        }
+        if (job < 0) return 0;
+        total = &batch->results[job];
+        left = batch->budget - total->cycles;
+        result = runcycles(batch->cpus[job], left < batch->slice ? left : batch->slice);
+        total->cycles += result.cycles;
+        total->instructions += result.instructions;
+        total->reason = result.reason;
+        if (result.reason != STOP_REQUESTED && total->cycles < batch->budget) pushjob(batch, own, job);
+    }
+}
+
+//
+// Run count independent cpus on threads worker threads (0 for one per host
+// core), until each one was stopped with stoprun or spent budget cycles, in
+// slices of slice cycles (0 for no slices). The cpus must not share anything
+// but read only memory or forked pages (see forkcpu), and the handlers of 
+// their devices and events run on the worker threads. results, if not NULL,
+// receives the cycles and opcodes run by each cpu and why it stopped. Returns
+// the number of threads used, or -1 if out of memory.
+//
+int runbatch(struct microprocessor **cpus, struct runresult *results, int count, int threads, unsigned long slice, unsigned long budget)
+{
+    struct batch batch;
+    struct batchworker *workers;
+    int *jobs, i;
+#ifdef BATCH_THREADS
+    pthread_t *ids;
+    int started;
+
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    threads = 1;
+#endif
+    if (threads > count) threads = count;
+    if (threads < 1) return 0;
+    batch.cpus = cpus;
+    batch.results = results ? results : malloc(count * sizeof *results);
+    batch.count = count;
+    batch.slice = slice ? slice : budget;
+    batch.budget = budget;
+    batch.queues = malloc(threads * sizeof *batch.queues);
+    batch.workers = threads;
+    workers = malloc(threads * sizeof *workers);
+    jobs = malloc((size_t) threads * count * sizeof *jobs);
+    if (!batch.results || !batch.queues || !workers || !jobs) {
+        if (!results) free(batch.results);
+        free(batch.queues);
+        free(workers);
+        free(jobs);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        batch.results[i].cycles = 0;
+        batch.results[i].instructions = 0;
+        batch.results[i].reason = STOP_CYCLES;
+    }
+    for (i = 0; i < threads; i++) {
+#ifdef BATCH_THREADS
+        pthread_mutex_init(&batch.queues[i].lock, 0);
+#endif
+        batch.queues[i].jobs = jobs + (size_t) i * count;
+        batch.queues[i].first = 0;
+        batch.queues[i].used = 0;
+        workers[i].batch = &batch;
+        workers[i].index = i;
+    }
+    for (i = 0; i < count; i++) pushjob(&batch, &batch.queues[i % threads], i);
+
+#ifdef BATCH_THREADS
+    //
+    // The calling thread is worker 0. If a thread can not be started, its 
+    // queue is emptied by stealing.
+    //
+    ids = malloc(threads * sizeof *ids);
+    started = 1;
+    for (i = 1; ids && i < threads; i++) {
+        if (pthread_create(&ids[i], 0, batchwork, &workers[i])) break;
+        started++;
+    }
+    batchwork(&workers[0]);
+    for (i = 1; i < started; i++) pthread_join(ids[i], 0);
+    for (i = 0; i < threads; i++) pthread_mutex_destroy(&batch.queues[i].lock);
+    free(ids);
+    threads = started;
+#else
+    batchwork(&workers[0]);
+#endif
+
+    if (!results) free(batch.results);
+    free(batch.queues);
+    free(workers);
+    free(jobs);
+    return threads;
+}
+
+//
+// Lockstep runner. Runs groups of LOCKSTEP_LANES cpus executing the same 
+// program on different data. The registers of a group are kept in vectors 
+// holding one byte per cpu (a lane), so an opcode found at the same pc in 
+// several lanes is executed once for all of them with vector instructions, 
+// on a mask of the lanes taking part. Each step executes the opcode at the 
+// lowest pc among the lanes left, so lanes split by a branch run one side 
+// and then the other, and go on together again once they meet at the same
+// pc. 
+//
+// The opcodes classed in opkind (and jsr, rts, pha and pla) are executed in
+// lockstep on the lanes whose opcode, operand and data are all on direct 
+// pages. The others go through processcommand one lane at a time, which is
+// also the reference the vector code follows: undocumented opcodes, stack 
+// and interrupt opcodes, decimal adc and sbc, accesses to I/O, protected or
+// copy on write pages, and lanes with an interrupt or an event due. Bus and
+// event handlers are only called from processcommand, with the registers of
+// their cpu up to date.
+//
+// The vectors use the vector extension of gcc and clang. They are as wide 
+// as the vector registers the compiler targets (e.g. AVX2 or AVX-512 when 
+// built with DEFINES=-march=native), since wider ones are split into scalar
+// code for the comparisons.
+//
+#ifndef LOCKSTEP_LANES
+#if defined(__AVX512BW__)
+#define LOCKSTEP_LANES 64
+#elif defined(__AVX2__)
+#define LOCKSTEP_LANES 32
+#else
+#define LOCKSTEP_LANES 16
+#endif
+#endif
+
+typedef unsigned char lanes __attribute((vector_size(LOCKSTEP_LANES)));
+
+struct lockstep {
+    lanes a, x, y, sp, status;
+    unsigned int pc[LOCKSTEP_LANES];            // LOCKSTEP_DONE added when done
+    unsigned long cycles[LOCKSTEP_LANES];
+    unsigned long limit[LOCKSTEP_LANES];        // cycle up to which the lane may run in lockstep
+    unsigned long end[LOCKSTEP_LANES];          // cycle the lane stops at
+    unsigned long instructions[LOCKSTEP_LANES];
+    struct microprocessor *cpu[LOCKSTEP_LANES];
+    int count;
+    unsigned int next;                          // lowest pc, LOCKSTEP_DONE when all done
+    unsigned long vector;                       // opcodes executed in lockstep
+
+    // lanes of the opcode being executed, in lockstep (list) or not (scalar)
+    int list[LOCKSTEP_LANES];
+    int scalar[LOCKSTEP_LANES];
+    int lanecount;
+    int scalars;
+    unsigned short address[LOCKSTEP_LANES];     // address referenced in each lane
+    unsigned char *page[LOCKSTEP_LANES];        // and the direct page it is on
+    unsigned char extra[LOCKSTEP_LANES];        // cycles added to the base cycles
+};
+
+#define LOCKSTEP_DONE 0x10000
+
+//
+// Vector helpers, as macros since the vectors may be wider than the vector 
+// registers the host ABI passes to functions. BLEND takes value for the 
+// lanes in mask and old for the others, NZBITS is the N and Z bits of the 
+// status for the value of each lane and COMPARE the status after cmp, cpx
+// or cpy.
+//
+#define BLEND(mask, value, old) (((value) & (mask)) | ((old) & ~(mask)))
+#define NZBITS(value) (((value) & 0x80) | ((lanes) ((value) == 0) & 0x02))
+#define COMPARE(status, reg, value) (((status) & 0x7C) | NZBITS((reg) - (value)) | ((lanes) ((reg) >= (value)) & 0x01))
+
+static void lockstepload(struct lockstep *group, int lane)
+{
+    struct microprocessor *cpu = group->cpu[lane];
+
+    group->a[lane] = cpu->a;
+    group->x[lane] = cpu->x;
+    group->y[lane] = cpu->y;
+    group->sp[lane] = cpu->sp;
+    group->status[lane] = cpu->status;
+    group->pc[lane] = cpu->pc;
+    group->cycles[lane] = cpu->cycles;
+}
+
+static void lockstepstore(struct lockstep *group, int lane)
+{
+    struct microprocessor *cpu = group->cpu[lane];
+
+    cpu->a = group->a[lane];
+    cpu->x = group->x[lane];
+    cpu->y = group->y[lane];
+    cpu->sp = group->sp[lane];
+    cpu->status = group->status[lane];
+    cpu->pc = (unsigned short) group->pc[lane];
+    cpu->cycles = group->cycles[lane];
+}
+
+//
+// What a lane does next, worked out when it is loaded and after each opcode
+// it runs with processcommand, which is the only place calling the handlers
+// that could change it: nothing when its run is over, processcommand again
+// while it has an interrupt to take, or else lockstep until its next event.
+//
+static void lockstepcheck(struct lockstep *group, int lane)
+{
+    struct microprocessor *cpu = group->cpu[lane];
+
+    if (cpu->stopped || group->cycles[lane] >= group->end[lane]) group->pc[lane] |= LOCKSTEP_DONE;
+    else if (cpu->signals || (cpu->irqlines && !(cpu->status & 0x04))) group->limit[lane] = 0;
+    else group->limit[lane] = cpu->events.next < group->end[lane] ? cpu->events.next : group->end[lane];
+}
+
+//
+// Run the opcode at the pc of a lane with processcommand
+//
+static void lockstepscalar(struct lockstep *group, int lane)
+{
+    lockstepstore(group, lane);
+    processcommand(group->cpu[lane]);
+    lockstepload(group, lane);
+    group->instructions[lane]++;
+    lockstepcheck(group, lane);
+}
+
+//
+// Copy the opcode at pc and its operand, returns their size or 0 when one 
+// of them is not on a direct page.
+//
+static int lockstepfetch(struct microprocessor *cpu, unsigned short pc, unsigned char *bytes)
+{
+    unsigned char *page;
+    int i, n = 1;
+
+    for (i = 0; i < n; i++, pc++) {
+        page = cpu->bus.readpage[pc >> 8];
+        if (!page) return 0;
+        bytes[i] = page[pc & 0xFF];
+        if (!i) n = opcodeinfo[bytes[0]].flags & OPCODE_SIZE;
+    }
+    return n;
+}
+
+//
+// Whether a lane has the n bytes of code at pc on direct pages. page is the
+// page of pc in the lane.
+//
+__attribute((always_inline)) static inline int lockstepsame(struct microprocessor *cpu, unsigned char *page, unsigned short pc, const unsigned char *bytes, int n)
+{
+    unsigned char other[3];
+
+    if (page && (pc & 0xFF) + n <= 0x100) {
+        page += pc & 0xFF;
+        return page[0] == bytes[0] && (n < 2 || page[1] == bytes[1]) && (n < 3 || page[2] == bytes[2]);
+    }
+    return lockstepfetch(cpu, pc, other) == n && !memcmp(other, bytes, n);
+}
+
+//
+// Addresses referenced by the opcode in the lanes of the list, the direct 
+// pages they are on and the page crossing penalty. The lanes referencing 
+// other pages move to the scalar list. Inlined for each mode, so the mode 
+// switch is resolved at compile time.
+//
+__attribute((always_inline)) static inline void lockstepaccess(struct lockstep *group, int kind, int mode, unsigned short operand, int penalty)
+{
+    struct microprocessor *cpu;
+    unsigned char *zero, *page;
+    unsigned short address = 0, base = operand;
+    int lane, i, n;
+
+    for (i = n = 0; i < group->lanecount; i++) {
+        lane = group->list[i];
+        cpu = group->cpu[lane];
+        group->extra[lane] = 0;
+        switch (mode) {
+        case MODE_ZP:  address = operand; break;
+        case MODE_ZPX: address = (unsigned char) (operand + group->x[lane]); break;
+        case MODE_ZPY: address = (unsigned char) (operand + group->y[lane]); break;
+        case MODE_ABS: address = operand; break;
+        case MODE_ABX: address = operand + group->x[lane]; break;
+        case MODE_ABY: address = operand + group->y[lane]; break;
+        case MODE_IZX:
+            zero = cpu->bus.readpage[0];
+            if (!zero) goto scalar;
+            base = (unsigned char) (operand + group->x[lane]);
+            base = zero[base] | zero[(unsigned char) (base + 1)] << 8;
+            address = base;
+            break;
+        case MODE_IZY:
+            zero = cpu->bus.readpage[0];
+            if (!zero) goto scalar;
+            base = zero[operand] | zero[(unsigned char) (operand + 1)] << 8;
+            address = base + group->y[lane];
+            break;
+        default:
+            // no address
+            group->list[n++] = lane;
+            continue;
+        }
+        if (kind <= KIND_SBC) page = cpu->bus.readpage[address >> 8];
+        else {
+            page = cpu->bus.writepage[address >> 8];
+            // read-modify-write opcodes need the same page both ways
+            if (kind >= KIND_INC && page != cpu->bus.readpage[address >> 8]) goto scalar;
+        }
+        if (!page) goto scalar;
+        if (penalty) group->extra[lane] = (address & 0xFF00) != (base & 0xFF00);
+        group->address[lane] = address;
+        group->page[lane] = page;
+        group->list[n++] = lane;
+        continue;
+scalar:
+        group->scalar[group->scalars++] = lane;
+    }
+    group->lanecount = n;
+}
+
+//
+// Execute one opcode: the opcode at the lowest pc, on all the lanes at that 
+// pc. Works out the lowest pc for the next step.
+//
+static void lockstepstep(struct lockstep *group)
+{
+    static const unsigned char branchflag[4] = { 0x80, 0x40, 0x01, 0x02 };
+    struct microprocessor *cpu;
+    lanes mask = { 0 }, value = { 0 }, result = { 0 }, taken;
+    lanes a = group->a, x = group->x, y = group->y, sp = group->sp, status = group->status;
+    unsigned char *code = 0, *page;
+    unsigned short next, target, returned;
+    unsigned char bytes[3] = { 0 };
+    unsigned int pc = group->next, lowest = LOCKSTEP_DONE;
+    int codesize = 0, jumped = 0, kind, mode, lane, i, n;
+    unsigned short operand;
+    unsigned char opcode;
+
+    //
+    // Lanes at pc with the same code as the first one (the same page or the
+    // same bytes), and no interrupt or event to take first
+    //
+    group->lanecount = 0;
+    group->scalars = 0;
+    for (lane = 0; lane < group->count; lane++) {
+        if (group->pc[lane] != pc) continue;
+        cpu = group->cpu[lane];
+        page = cpu->bus.readpage[pc >> 8];
+        if (group->cycles[lane] >= group->limit[lane]) group->scalar[group->scalars++] = lane;
+        else if (group->lanecount ? (code && page == code) || lockstepsame(cpu, page, pc, bytes, codesize) : 
+                 (codesize = lockstepfetch(cpu, pc, bytes)) != 0) {
+            if (!group->lanecount && (pc & 0xFF) + codesize <= 0x100) code = page;
+            group->list[group->lanecount++] = lane;
+        }
+        else group->scalar[group->scalars++] = lane;
+    }
+
+    opcode = bytes[0];
+    kind = opkind[opcode];
+    mode = opcodeinfo[opcode].mode;
+    operand = codesize == 3 ? bytes[1] | bytes[2] << 8 : bytes[1];
+    if (kind == KIND_HELPER) {
+        // jsr, rts, pha and pla only use the stack, the others run alone
+        for (i = n = 0; i < group->lanecount; i++) {
+            lane = group->list[i];
+            cpu = group->cpu[lane];
+            page = cpu->bus.writepage[1];
+            group->extra[lane] = 0;
+            group->page[lane] = page;
+            if ((opcode == 0x20 || opcode == 0x60 || opcode == 0x48 || opcode == 0x68) && page && page == cpu->bus.readpage[1])
+                group->list[n++] = lane;
+            else group->scalar[group->scalars++] = lane;
+        }
+        group->lanecount = n;
+    }
+    else {
+        if (kind == KIND_ADC || kind == KIND_SBC) {
+            // decimal mode runs alone
+            for (i = n = 0; i < group->lanecount; i++) {
+                lane = group->list[i];
+                if (group->status[lane] & 0x08) group->scalar[group->scalars++] = lane;
+                else group->list[n++] = lane;
+            }
+            group->lanecount = n;
+        }
+        switch (kind == KIND_JMP ? MODE_IMP : mode) {
+        case MODE_ZP:  lockstepaccess(group, kind, MODE_ZP, operand, 0); break;
+        case MODE_ZPX: lockstepaccess(group, kind, MODE_ZPX, operand, 0); break;
+        case MODE_ZPY: lockstepaccess(group, kind, MODE_ZPY, operand, 0); break;
+        case MODE_ABS: lockstepaccess(group, kind, MODE_ABS, operand, 0); break;
+        case MODE_ABX: lockstepaccess(group, kind, MODE_ABX, operand, opcodeinfo[opcode].flags & OPCODE_PENALTY); break;
+        case MODE_ABY: lockstepaccess(group, kind, MODE_ABY, operand, opcodeinfo[opcode].flags & OPCODE_PENALTY); break;
+        case MODE_IZX: lockstepaccess(group, kind, MODE_IZX, operand, 0); break;
+        case MODE_IZY: lockstepaccess(group, kind, MODE_IZY, operand, opcodeinfo[opcode].flags & OPCODE_PENALTY); break;
+        default:       lockstepaccess(group, kind, MODE_IMP, operand, 0); break;
+        }
+    }
+
+    if (group->lanecount) {
+        for (i = 0; i < group->lanecount; i++) mask[group->list[i]] = 0xFF;
+        if (mode == MODE_IMM) value += (unsigned char) operand;
+        else if (mode >= MODE_ZP && kind != KIND_HELPER && (kind <= KIND_SBC || (kind >= KIND_INC && kind <= KIND_ROR))) {
+            for (i = 0; i < group->lanecount; i++) {
+                lane = group->list[i];
+                value[lane] = group->page[lane][group->address[lane] & 0xFF];
+            }
+        }
+        else if (mode == MODE_IMP) value = a;
+
+        next = pc + codesize;
+        switch (kind) {
+        case KIND_LDA: a = value; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_LDX: x = value; status = (status & 0x7D) | NZBITS(x); break;
+        case KIND_LDY: y = value; status = (status & 0x7D) | NZBITS(y); break;
+        case KIND_AND: a &= value; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_ORA: a |= value; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_EOR: a ^= value; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_CMP: status = COMPARE(status, a, value); break;
+        case KIND_CPX: status = COMPARE(status, x, value); break;
+        case KIND_CPY: status = COMPARE(status, y, value); break;
+        case KIND_BIT: status = (status & 0x3D) | (value & 0xC0) | ((lanes) ((value & a) == 0) & 0x02); break;
+        case KIND_SBC: 
+            value = ~value;
+            // fall through
+        case KIND_ADC:
+            result = a + value + (status & 0x01);
+            status = (status & 0x3C) | NZBITS(result) | ((~(a ^ value) & (a ^ result) & 0x80) >> 1) | 
+                     (((a & value) | ((a | value) & ~result)) >> 7);
+            a = result;
+            break;
+        case KIND_STA: result = a; break;
+        case KIND_STX: result = x; break;
+        case KIND_STY: result = y; break;
+        case KIND_INC: result = value + 1; status = (status & 0x7D) | NZBITS(result); break;
+        case KIND_DEC: result = value - 1; status = (status & 0x7D) | NZBITS(result); break;
+        case KIND_ASL: result = value << 1; status = (status & 0x7C) | NZBITS(result) | value >> 7; break;
+        case KIND_LSR: result = value >> 1; status = (status & 0x7C) | NZBITS(result) | (value & 0x01); break;
+        case KIND_ROL: 
+            result = value << 1 | (status & 0x01); 
+            status = (status & 0x7C) | NZBITS(result) | value >> 7; 
+            break;
+        case KIND_ROR: 
+            result = value >> 1 | (status & 0x01) << 7; 
+            status = (status & 0x7C) | NZBITS(result) | (value & 0x01); 
+            break;
+        case KIND_INX: x += 1; status = (status & 0x7D) | NZBITS(x); break;
+        case KIND_INY: y += 1; status = (status & 0x7D) | NZBITS(y); break;
+        case KIND_DEX: x -= 1; status = (status & 0x7D) | NZBITS(x); break;
+        case KIND_DEY: y -= 1; status = (status & 0x7D) | NZBITS(y); break;
+        case KIND_TAX: x = a; status = (status & 0x7D) | NZBITS(x); break;
+        case KIND_TAY: y = a; status = (status & 0x7D) | NZBITS(y); break;
+        case KIND_TXA: a = x; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_TYA: a = y; status = (status & 0x7D) | NZBITS(a); break;
+        case KIND_TSX: x = sp; status = (status & 0x7D) | NZBITS(x); break;
+        case KIND_TXS: sp = x; break;
+        case KIND_CLC: status &= 0xFE; break;
+        case KIND_SEC: status |= 0x01; break;
+        case KIND_SEI: status |= 0x04; break;
+        case KIND_CLD: status &= 0xF7; break;
+        case KIND_SED: status |= 0x08; break;
+        case KIND_CLV: status &= 0xBF; break;
+        case KIND_NOP: break;
+        case KIND_BRANCH:
+            // bits 7 and 6 of the opcode select the flag, bit 5 its value
+            taken = (lanes) ((status & branchflag[opcode >> 6]) == 0);
+            if (opcode & 0x20) taken = ~taken;
+            target = next + (signed char) operand;
+            for (i = 0; i < group->lanecount; i++) {
+                lane = group->list[i];
+                group->pc[lane] = taken[lane] ? target : next;
+                if (taken[lane]) group->extra[lane] = 1 + ((target & 0xFF00) != (next & 0xFF00));
+            }
+            jumped = 1;
+            break;
+        case KIND_JMP: next = operand; break;
+        default:
+            for (i = 0; i < group->lanecount; i++) {
+                lane = group->list[i];
+                page = group->page[lane];
+                switch (opcode) {
+                case 0x20:
+                    // jsr pushes the address of its last byte
+                    returned = next - 1;
+                    page[sp[lane]] = returned >> 8;
+                    page[(unsigned char) (sp[lane] - 1)] = returned & 0xFF;
+                    break;
+                case 0x60:
+                    returned = page[(unsigned char) (sp[lane] + 1)] | page[(unsigned char) (sp[lane] + 2)] << 8;
+                    group->pc[lane] = (unsigned short) (returned + 1);
+                    jumped = 1;
+                    break;
+                case 0x48: page[sp[lane]] = a[lane]; break;
+                case 0x68: value[lane] = page[(unsigned char) (sp[lane] + 1)]; break;
+                }
+            }
+            if (opcode == 0x20) sp -= 2;
+            if (opcode == 0x60) sp += 2;
+            if (opcode == 0x48) sp -= 1;
+            if (opcode == 0x68) {
+                sp += 1;
+                a = value;
+                status = (status & 0x7D) | NZBITS(a);
+            }
+            if (opcode == 0x20) next = operand;
+            break;
+        }
+        if (kind >= KIND_STA && kind <= KIND_ROR) {
+            if (mode == MODE_IMP) a = result;
+            else for (i = 0; i < group->lanecount; i++) {
+                lane = group->list[i];
+                group->page[lane][group->address[lane] & 0xFF] = result[lane];
+            }
+        }
+
+        group->a = BLEND(mask, a, group->a);
+        group->x = BLEND(mask, x, group->x);
+        group->y = BLEND(mask, y, group->y);
+        group->sp = BLEND(mask, sp, group->sp);
+        group->status = BLEND(mask, status, group->status);
+        if (!jumped) for (i = 0; i < group->lanecount; i++) group->pc[group->list[i]] = next;
+        for (lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            group->cycles[lane] += (opcodeinfo[opcode].cycles + group->extra[lane]) & (unsigned long) (signed char) mask[lane];
+            group->instructions[lane] += mask[lane] & 1;
+        }
+        group->vector += group->lanecount;
+    }
+
+    for (i = 0; i < group->scalars; i++) lockstepscalar(group, group->scalar[i]);
+    for (lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        if (group->cycles[lane] >= group->end[lane]) group->pc[lane] |= LOCKSTEP_DONE;
+        if (group->pc[lane] < lowest) lowest = group->pc[lane];
+    }
+    group->next = lowest;
+}
+
+//
+// Run each cpu until at least budget cycles were spent or stoprun is called,
+// as runcycles would, LOCKSTEP_LANES cpus at a time in lockstep. The cpus 
+// must not share memory (forks of the same cpu are fine, see forkcpu), nor
+// change the state of each other from their handlers. The cpus using the 
+// cycle exact engine, the trace or the profile are run with runcycles 
+// instead. Fills results (when not NULL) as runbatch does, and returns the
+// number of opcodes executed in lockstep, all lanes counted.
+//
+unsigned long runlockstep(struct microprocessor **cpus, struct runresult *results, int count, unsigned long budget)
+{
+    struct lockstep group;
+    struct microprocessor *cpu;
+    struct runresult result;
+    unsigned long start[LOCKSTEP_LANES], vector = 0;
+    int index[LOCKSTEP_LANES], first, lane, i;
+
+    for (first = 0; first < count; first += LOCKSTEP_LANES) {
+        // the lanes without a cpu are done from the start
+        memset(&group, 0, sizeof group);
+        for (lane = 0; lane < LOCKSTEP_LANES; lane++) group.pc[lane] = LOCKSTEP_DONE;
+        group.count = 0;
+        group.next = LOCKSTEP_DONE;
+        group.vector = 0;
+        for (i = first; i < count && i < first + LOCKSTEP_LANES; i++) {
+            cpu = cpus[i];
+            if (cpu->exact || cpu->trace.records || cpu->profile) {
+                result = runcycles(cpu, budget);
+                if (results) results[i] = result;
+                continue;
+            }
+            lane = group.count++;
+            group.cpu[lane] = cpu;
+            lockstepload(&group, lane);
+            group.end[lane] = cpu->cycles + budget < cpu->cycles ? ULONG_MAX : cpu->cycles + budget;
+            group.instructions[lane] = 0;
+            start[lane] = cpu->cycles;
+            index[lane] = i;
+            cpu->stopped = 0;
+            lockstepcheck(&group, lane);
+            if (group.pc[lane] < group.next) group.next = group.pc[lane];
+        }
+
+        while (group.next != LOCKSTEP_DONE) lockstepstep(&group);
+
+        for (lane = 0; lane < group.count; lane++) {
+            cpu = group.cpu[lane];
+            lockstepstore(&group, lane);
+            if (!results) continue;
+            results[index[lane]].cycles = cpu->cycles - start[lane];
+            results[index[lane]].instructions = group.instructions[lane];
+            results[index[lane]].reason = cpu->stopped ? STOP_REQUESTED : STOP_CYCLES;
+        }
+        vector += group.vector;
+    }
+    return vector;
+}
+
+//
+// Take an interrupt (if the interrupt flag is clear) or an nmi right away,
+// whatever the state of the interrupt lines. 
+//
+void interrupt (struct microprocessor *cpu)
+{
+    int outside = !cpu->running;
+
+    if (outside) loadflags(cpu);
+    cpu->breakblock = 1;
+    if (!(cpu->status&0x04)) entervector(cpu, 0xFFFE);
+    if (outside) storeflags(cpu);
+}
+
+void nmi (struct microprocessor *cpu)
+{
+    int outside = !cpu->running;
+
+    if (outside) loadflags(cpu);
+    cpu->breakblock = 1;
+    entervector(cpu, 0xFFFA);
+    if (outside) storeflags(cpu);
+}
+
+//
+// Interrupt lines, driven by the devices, e.g. from their bus handlers. The
+// irq line is asserted while any of the source bits is asserted, so each 
+// device can use a bit of its own. The nmi is taken on the rising edge of 
+// its line. The run loop takes them before the next opcode, the current run
+// carries on.
+//
+void setirq(struct microprocessor *cpu, unsigned int source, int level)
+{
+    if (level) cpu->irqlines |= source;
+    else cpu->irqlines &= ~source;
+    updateirq(cpu);
+    if (cpu->signals) cpu->breakblock = 1;
+}
+
+void setnmi(struct microprocessor *cpu, int level)
+{
+    if (level && !cpu->nmiline) {
+        cpu->signals |= SIGNAL_NMI;
+        cpu->breakblock = 1;
+    }
+    cpu->nmiline = level != 0;
+}
+
+//
+// Handlers for pages with nothing mapped. Reads return 0xFF, writes are lost.
+//
+static unsigned char openbusread(void *context, unsigned short address)
+{
+    return 0xFF;
+}
+
+static void openbuswrite(void *context, unsigned short address, unsigned char value)
+{
+}
+
+//
+// Pages of a fork (see forkcpu). A RAM page of the parent is shared by the 
+// fork until the fork writes to it: the reads go to the memory of the parent,
+// the writes to cowwrite, which gives the fork a copy of its own. The copies
+// are marked in cpu->forked and given back by releasepage when the page is
+// mapped again.
+//
+static unsigned char *copypage(struct microprocessor *cpu, int page)
+{
+    unsigned char *copy = malloc(256);
+
+    if (!copy) return 0;
+    memcpy(copy, cpu->bus.readpage[page], 256);
+    cpu->bus.readpage[page] = copy;
+    cpu->bus.writepage[page] = copy;
+    cpu->bus.io[page].read = openbusread;
+    cpu->bus.io[page].write = openbuswrite;
+    cpu->bus.io[page].context = 0;
+    cpu->forked[page >> 3] |= 1 << (page & 7);
+    return copy;
+}
+
+static void cowwrite(void *context, unsigned short address, unsigned char value)
+{
+    struct microprocessor *cpu = context;
+    unsigned char page = address >> 8;
+    int i;
+
+    if (!copypage(cpu, page)) {
+        stoprun(cpu);
+        return;
+    }
+    // code decoded from the shared page is still valid, protect the copy so
+    // the writes to it are seen by the block cache
+    if (cpu->blocks) {
+        for (i = 0; i < 32; i++) {
+            if (cpu->blocks->code[(page << 5) + i]) {
+                protectpage(cpu, cpu->blocks, page);
+                break;
+            }
+        }
+    }
+    writememory(cpu, address, value);
+}
+
+static void releasepage(struct microprocessor *cpu, int page)
+{
+    if (!(cpu->forked[page >> 3] & (1 << (page & 7)))) return;
+    free(cpu->bus.readpage[page]);
+    cpu->forked[page >> 3] &= ~(1 << (page & 7));
+}
+
+//
+// Initialize a cpu context: registers cleared (status 0x20), nothing mapped
+// on the bus and diagnostics only counted. Must be called before using the
+// context. The user code then maps the memory and sets the pc.
+//
+void initcpu(struct microprocessor *cpu)
+{
+    int i;
+
+    cpu->a = 0;
+    cpu->x = 0;
+    cpu->y = 0;
+    cpu->sp = 0;
+    cpu->pc = 0;
+    cpu->status = 0x20;
+    cpu->cycles = 0;
+    cpu->bordercross = 0;
+    cpu->address = 0;
+    cpu->pending = 0;
+    cpu->partial = 0;
+    cpu->stopped = 0;
+    cpu->deadline = 0;
+    cpu->running = 0;
+    cpu->blocks = 0;
+    cpu->exact = 0;
+    cpu->irqlines = 0;
+    cpu->nmiline = 0;
+    cpu->signals = 0;
+    cpu->events.next = ULONG_MAX;
+    cpu->events.count = 0;
+    for (i = 0; i < 32; i++) cpu->forked[i] = 0;
+    initbus(cpu);
+    setdiagnostics(cpu, 0, 0, 0, 0);
+    settrace(cpu, 0, 0);
+    setprofile(cpu, 0);
+}
+
+//
+// Unmap the whole address space. Must be called before mapping any page. The
+// mapping functions flush the block cache, as the code may have changed.
+//
+void initbus(struct microprocessor *cpu)
+{
+    int page;
+    flushblocks(cpu);
+    for (page=0; page<256; page++) {
+        releasepage(cpu, page);
+        cpu->bus.readpage[page] = 0;
+        cpu->bus.writepage[page] = 0;
+        cpu->bus.io[page].read = openbusread;
+        cpu->bus.io[page].write = openbuswrite;
+        cpu->bus.io[page].context = 0;
+    }
+}
+
+//
+// Map pages to host memory (RAM). Reads and writes go directly to the array.
+//
+void mapmemory(struct microprocessor *cpu, unsigned char page, unsigned int pages, unsigned char *memory)
+{
+    unsigned int i;
+    flushblocks(cpu);
+    for (i=0; i<pages && page+i<256; i++) {
+        releasepage(cpu, page+i);
+        cpu->bus.readpage[page+i] = memory + (i<<8);
+        cpu->bus.writepage[page+i] = memory + (i<<8);
+    }
+}
+
+//
+// Map pages to host memory as ROM. Reads go directly to the array, writes are
+// ignored.
+//
+void maprom(struct microprocessor *cpu, unsigned char page, unsigned int pages, unsigned char *memory)
+{
+    unsigned int i;
+    flushblocks(cpu);
+    for (i=0; i<pages && page+i<256; i++) {
+        releasepage(cpu, page+i);
+        cpu->bus.readpage[page+i] = memory + (i<<8);
+        cpu->bus.writepage[page+i] = 0;
+        cpu->bus.io[page+i].write = openbuswrite;
+    }
+}
+
+//
+// Map pages to handler functions, for I/O devices. A NULL handler leaves the
+// corresponding access unmapped. The handlers receive the full 16 bit address.
+//
+void mapio(struct microprocessor *cpu, unsigned char page, unsigned int pages, readhandler read, writehandler write, void *context)
+{
+    unsigned int i;
+    flushblocks(cpu);
+    for (i=0; i<pages && page+i<256; i++) {
+        releasepage(cpu, page+i);
+        cpu->bus.readpage[page+i] = 0;
+        cpu->bus.writepage[page+i] = 0;
+        cpu->bus.io[page+i].read = read ? read : openbusread;
+        cpu->bus.io[page+i].write = write ? write : openbuswrite;
+        cpu->bus.io[page+i].context = context;
+    }
+}
+
+//
+// Set the handler of the diagnostic events and clear the counters. A NULL
+// handler only counts the events. At most limit events are passed to the 
+// handler in each window of cycles, the rest are counted as dropped. A limit
+// of 0 passes all the events.
+//
+void setdiagnostics(struct microprocessor *cpu, diaghandler handler, void *context, unsigned long limit, unsigned long window)
+{
+    int kind;
+    cpu->diag.handler = handler;
+    cpu->diag.context = context;
+    cpu->diag.limit = limit;
+    cpu->diag.window = window;
+    cpu->diag.windowstart = cpu->cycles;
+    cpu->diag.reported = 0;
+    cpu->diag.dropped = 0;
+    for (kind=0; kind<DIAG_KINDS; kind++) cpu->diag.count[kind] = 0;
+}
+
+//
+// Diagnostic handler printing one line per event, on the FILE passed as 
+// context (stdout when NULL)
+//
+void printdiagnostic(void *context, unsigned char opcode, unsigned short pc, int kind)
+{
+    static const char *description[DIAG_KINDS] = { "undocumented opcode", 
+                                                    "undocumented nop", 
+                                                    "JAM detected, execution continues",
+                                                    "unstable opcode",
+                                                    "opcode not implemented, executed as nop" };
+    fprintf(context ? (FILE *) context : stdout, "%s %02X at %04X\n", description[kind], opcode, pc);
+}
+
+//
+// Decode the opcodes in the length bytes of buffer, loaded at origin, into
+// ops, which needs room for length entries (one per byte at worst). Decoding
+// stops before an opcode whose operand does not fit in the buffer. Returns
+// the number of opcodes decoded.
+//
+// Code read as data decodes to random opcodes, so the main loop has no test
+// depending on the opcode: it reads two operand bytes every time, masks them
+// to the size of the opcode and picks the branch target with a conditional
+// move. Only the last two bytes of the buffer are decoded with tests.
+//
+unsigned long disassemble(const unsigned char *buffer, unsigned long length, unsigned short origin, struct disasmop *ops)
+{
+    static const unsigned short operandmask[4] = { 0, 0, 0x00FF, 0xFFFF };
+    struct disasmop *op = ops;
+    struct opcodeinfo info;
+    unsigned long at = 0;
+    unsigned short pc, operand, target;
+    int size;
+
+    while (at + 3 <= length) {
+        info = opcodeinfo[buffer[at]];
+        size = info.flags & OPCODE_SIZE;
+        pc = (unsigned short) (origin + at);
+        operand = (buffer[at + 1] | buffer[at + 2] << 8) & operandmask[size];
+        target = (unsigned short) (pc + 2 + (signed char) buffer[at + 1]);
+        op->pc = pc;
+        op->operand = info.mode == MODE_REL ? target : operand;
+        op->opcode = buffer[at];
+        op->size = size;
+        at += size;
+        op++;
+    }
+    while (at < length) {
+        info = opcodeinfo[buffer[at]];
+        size = info.flags & OPCODE_SIZE;
+        if (at + size > length) break;
+        pc = (unsigned short) (origin + at);
+        operand = size == 2 ? buffer[at + 1] : 0;
+        op->pc = pc;
+        op->operand = info.mode == MODE_REL ? (unsigned short) (pc + 2 + (signed char) operand) : operand;
+        op->opcode = buffer[at];
+        op->size = size;
+        at += size;
+        op++;
+    }
+    return (unsigned long) (op - ops);
+}
+
+//
+// Write the text of a decoded opcode, e.g. "lda ($12),y", with the operand in
+// hex. Like disassemble it avoids the tests on the opcode: every part of the
+// text (mnemonic, space, prefix, digits, suffix) is copied whole, with a 
+// length taken from the format of its mode, and the next part is written 
+// after that length. The text buffer must have DISASM_TEXTSIZE bytes. 
+// Returns the length of the text.
+//
+struct disasmformat {
+    char prefix[4];
+    char suffix[4];
+    unsigned char prefixlength;
+    unsigned char suffixlength;
+    unsigned char digits;
+    unsigned char space;
+};
+
+int formatopcode(const struct disasmop *op, char *text)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    static const struct disasmformat formats[MODE_COUNT + 1] = {
+        { "",   "",    0, 0, 0, 0 },    // MODE_IMP
+        { "#$", "",    2, 0, 2, 1 },    // MODE_IMM
+        { "$",  "",    1, 0, 4, 1 },    // MODE_REL
+        { "$",  "",    1, 0, 2, 1 },    // MODE_ZP
+        { "$",  ",x",  1, 2, 2, 1 },    // MODE_ZPX
+        { "$",  ",y",  1, 2, 2, 1 },    // MODE_ZPY
+        { "$",  "",    1, 0, 4, 1 },    // MODE_ABS
+        { "$",  ",x",  1, 2, 4, 1 },    // MODE_ABX
+        { "$",  ",y",  1, 2, 4, 1 },    // MODE_ABY
+        { "($", ")",   2, 1, 4, 1 },    // MODE_IND
+        { "($", ",x)", 2, 3, 2, 1 },    // MODE_IZX
+        { "($", "),y", 2, 3, 2, 1 },    // MODE_IZY
+        { "a",  "",    1, 0, 0, 1 } };  // asl, lsr, rol and ror on the accumulator
+    const struct opcodeinfo *info = &opcodeinfo[op->opcode];
+    const struct disasmformat *format;
+    unsigned short value;
+    char *p = text;
+
+    format = &formats[info->mode == MODE_IMP && (op->opcode & 0x9F) == 0x0A ? MODE_COUNT : info->mode];
+    // two digit operands are shifted to the top, the digits are written from there
+    value = format->digits == 4 ? op->operand : (unsigned short) (op->operand << 8);
+    memcpy(p, opcodenames[info->mnemonic], 4);
+    p += 3;
+    *p = ' ';
+    p += format->space;
+    memcpy(p, format->prefix, 4);
+    p += format->prefixlength;
+    p[0] = hex[value >> 12];
+    p[1] = hex[(value >> 8) & 0xF];
+    p[2] = hex[(value >> 4) & 0xF];
+    p[3] = hex[value & 0xF];
+    p += format->digits;
+    memcpy(p, format->suffix, 4);
+    p += format->suffixlength;
+    *p = 0;
+    return (int) (p - text);
+}
+
+//
+// Start writing one trace record per opcode to the records array, used as a
+// ring buffer: when it is full the oldest records are overwritten. The size
+// is rounded down to a power of two. A NULL array (or size 0) stops the trace.
+//
+void settrace(struct microprocessor *cpu, struct tracerecord *records, unsigned long size)
+{
+    unsigned long mask = 1;
+
+    if (!records || !size) {
+        cpu->trace.records = 0;
+        cpu->trace.mask = 0;
+        cpu->trace.count = 0;
+        return;
+    }
+    while (mask <= size / 2) mask <<= 1;
+    cpu->trace.records = records;
+    cpu->trace.mask = mask - 1;
+    cpu->trace.count = 0;
+}
+
+//
+// Save the records in the trace buffer to a file, oldest first, to be decoded
+// by tracedump6502. Each record is written as TRACE_RECORDSIZE bytes in a 
+// fixed little endian layout after the TRACE_MAGIC header, so the file can be
+// read on any host. Returns the number of records saved, or -1 on error.
+//
+long savetrace(struct microprocessor *cpu, const char *filename)
+{
+    struct tracerecord *record;
+    unsigned char bytes[TRACE_RECORDSIZE];
+    unsigned long first = 0, i;
+    FILE *file;
+
+    if (!cpu->trace.records) return -1;
+    file = fopen(filename, "wb");
+    if (!file) return -1;
+    if (cpu->trace.count > cpu->trace.mask + 1) first = cpu->trace.count - (cpu->trace.mask + 1);
+    fwrite(TRACE_MAGIC, 1, 8, file);
+    for (i = first; i < cpu->trace.count; i++) {
+        record = &cpu->trace.records[i & cpu->trace.mask];
+        bytes[0] = (unsigned char) record->cycles;
+        bytes[1] = (unsigned char) (record->cycles >> 8);
+        bytes[2] = (unsigned char) (record->cycles >> 16);
+        bytes[3] = (unsigned char) (record->cycles >> 24);
+        bytes[4] = (unsigned char) record->pc;
+        bytes[5] = (unsigned char) (record->pc >> 8);
+        bytes[6] = (unsigned char) record->address;
+        bytes[7] = (unsigned char) (record->address >> 8);
+        bytes[8] = record->opcode;
+        bytes[9] = record->operand[0];
+        bytes[10] = record->operand[1];
+        bytes[11] = record->a;
+        bytes[12] = record->x;
+        bytes[13] = record->y;
+        bytes[14] = record->sp;
+        bytes[15] = record->status;
+        fwrite(bytes, 1, TRACE_RECORDSIZE, file);
+    }
+    if (fclose(file)) return -1;
+    return (long) (cpu->trace.count - first);
+}
+
+//
+// Start counting the opcodes and cycles of the cpu in profile, which is 
+// cleared first. The calls are counted from the current pc, the root of the
+// call tree. A NULL profile stops the profile.
+//
+void setprofile(struct microprocessor *cpu, struct profile *profile)
+{
+    int i;
+
+    cpu->profile = profile;
+    if (!profile) return;
+    memset(profile, 0, sizeof *profile);
+    for (i = 0; i < PROFILE_NODES; i++) profile->hash[i] = -1;
+    profile->nodes[0].address = cpu->pc;
+    profile->nodes[0].parent = -1;
+    profile->nodes[0].next = -1;
+    profile->nodecount = 1;
+    profile->last = cpu->cycles;
+    profile->next = cpu->pc;
+    profile->lastsp = cpu->sp;
+}
+
+struct profileline {
+    unsigned long cycles;
+    unsigned long count;
+    unsigned int key;
+};
+
+static int profilecompare(const void *a, const void *b)
+{
+    const struct profileline *x = a, *y = b;
+
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+//
+// Write the lines of the flat profile with the most cycles first
+//
+static void profilelines(FILE *file, const char *title, struct profileline *lines, int count, unsigned long total, int digits)
+{
+    int i;
+
+    qsort(lines, count, sizeof *lines, profilecompare);
+    fprintf(file, "# %-7s %14s %7s %14s\n", title, "cycles", "%", "opcodes");
+    for (i = 0; i < count; i++) {
+        fprintf(file, "  %0*X%*s %14lu %7.2f %14lu\n", digits, lines[i].key, 7 - digits, "", lines[i].cycles, 
+                total ? lines[i].cycles * 100.0 / total : 0.0, lines[i].count);
+    }
+}
+
+//
+// Save the flat profile to a text file: one line per address executed, with
+// the cycles spent there, their share of the total and the opcodes executed,
+// the most cycles first, then the same for each opcode. The lines other than
+// the counters start with #. Returns the number of addresses saved, or -1 on 
+// error.
+//
+long saveprofile(struct microprocessor *cpu, const char *filename)
+{
+    struct profile *profile = cpu->profile;
+    struct profileline *lines;
+    unsigned long cycles = 0, count = 0;
+    int used = 0, opcodes = 0, i;
+    FILE *file;
+
+    if (!profile) return -1;
+    lines = malloc(65536 * sizeof *lines);
+    if (!lines) return -1;
+    file = fopen(filename, "w");
+    if (!file) {
+        free(lines);
+        return -1;
+    }
+    for (i = 0; i < 256; i++) {
+        cycles += profile->opcodecycles[i];
+        count += profile->opcodecount[i];
+    }
+    fprintf(file, "# flat profile: %lu opcodes, %lu cycles\n", count, cycles);
+    for (i = 0; i < 65536; i++) {
+        if (!profile->count[i]) continue;
+        lines[used].cycles = profile->cycles[i];
+        lines[used].count = profile->count[i];
+        lines[used].key = i;
+        used++;
+    }
+    profilelines(file, "address", lines, used, cycles, 4);
+    for (i = 0; i < 256; i++) {
+        if (!profile->opcodecount[i]) continue;
+        lines[opcodes].cycles = profile->opcodecycles[i];
+        lines[opcodes].count = profile->opcodecount[i];
+        lines[opcodes].key = i;
+        opcodes++;
+    }
+    profilelines(file, "opcode", lines, opcodes, cycles, 2);
+    free(lines);
+    if (fclose(file)) return -1;
+    return used;
+}
+
+//
+// Save the call stacks of the profile to a text file in the folded format of
+// the flame graph tools: one line per call with cycles spent in the call 
+// itself, made of the addresses called from the root down, separated by ;, 
+// and of the cycles. Returns the number of lines saved, or -1 on error.
+//
+long savestacks(struct microprocessor *cpu, const char *filename)
+{
+    struct profile *profile = cpu->profile;
+    int chain[PROFILE_DEPTH];
+    int node, depth, i;
+    long lines = 0;
+    FILE *file;
+
+    if (!profile) return -1;
+    file = fopen(filename, "w");
+    if (!file) return -1;
+    for (i = 0; i < profile->nodecount; i++) {
+        if (!profile->nodes[i].cycles) continue;
+        depth = 0;
+        for (node = i; node >= 0 && depth < PROFILE_DEPTH; node = profile->nodes[node].parent) chain[depth++] = node;
+        while (depth--) fprintf(file, "%04X%c", profile->nodes[chain[depth]].address, depth ? ';' : ' ');
+        fprintf(file, "%lu\n", profile->nodes[i].cycles);
+        lines++;
+    }
+    if (fclose(file)) return -1;
+    return lines;
+}
+
+//
+// Host memory of a RAM page (mapped with mapmemory), or NULL for ROM, I/O and
+// unmapped pages. The writes to the RAM pages holding cached code go through
+// codewrite, the block cache keeps the memory of those pages. The pages a 
+// fork shares with its parent are RAM too, but must be copied before they
+// are written.
+//
+static unsigned char *rampage(struct microprocessor *cpu, int page)
+{
+    if (cpu->blocks && cpu->blocks->memory[page]) return cpu->blocks->memory[page];
+    if (cpu->bus.writepage[page] && cpu->bus.writepage[page] == cpu->bus.readpage[page]) return cpu->bus.writepage[page];
+    if (cpu->bus.io[page].write == cowwrite) return cpu->bus.readpage[page];
+    return 0;
+}
+
+//
+// Bytes taken by a snapshot of the cpu: the header and 256 bytes per RAM page.
+//
+unsigned long snapshotsize(struct microprocessor *cpu)
+{
+    unsigned long size = SNAPSHOT_HEADERSIZE;
+    int page;
+
+    for (page = 0; page < 256; page++) {
+        if (rampage(cpu, page)) size += 256;
+    }
+    return size;
+}
+
+//
+// Save the registers, the cycle counter, the interrupt lines and the RAM 
+// pages to buffer, in the little endian layout below, readable on any host:
+//
+//    0  SNAPSHOT_MAGIC (8 bytes)
+//    8  SNAPSHOT_VERSION (2 bytes)
+//   10  a, x, y, sp, pc (2 bytes), status, nmiline, signals, 0
+//   20  irqlines (4 bytes)
+//   24  cycles (8 bytes)
+//   32  bitmap of the RAM pages saved (page n is bit n & 7 of byte n >> 3)
+//   64  256 bytes per RAM page saved, lowest page first
+//
+// Returns the bytes written, or -1 if the buffer is smaller than snapshotsize.
+// Call it between runs, not from the bus handlers.
+//
+long savesnapshot(struct microprocessor *cpu, unsigned char *buffer, unsigned long size)
+{
+    unsigned char *memory, *bytes = buffer + SNAPSHOT_HEADERSIZE;
+    int page, i;
+
+    if (size < snapshotsize(cpu)) return -1;
+    memcpy(buffer, SNAPSHOT_MAGIC, 8);
+    buffer[8] = (unsigned char) SNAPSHOT_VERSION;
+    buffer[9] = (unsigned char) (SNAPSHOT_VERSION >> 8);
+    buffer[10] = cpu->a;
+    buffer[11] = cpu->x;
+    buffer[12] = cpu->y;
+    buffer[13] = cpu->sp;
+    buffer[14] = (unsigned char) cpu->pc;
+    buffer[15] = (unsigned char) (cpu->pc >> 8);
+    buffer[16] = cpu->status;
+    buffer[17] = cpu->nmiline;
+    buffer[18] = cpu->signals;
+    buffer[19] = 0;
+    for (i = 0; i < 4; i++) buffer[20 + i] = (unsigned char) (cpu->irqlines >> (8 * i));
+    for (i = 0; i < 8; i++) buffer[24 + i] = (unsigned char) ((unsigned long long) cpu->cycles >> (8 * i));
+    memset(buffer + 32, 0, 32);
+    for (page = 0; page < 256; page++) {
+        memory = rampage(cpu, page);
+        if (!memory) continue;
+        buffer[32 + (page >> 3)] |= 1 << (page & 7);
+        memcpy(bytes, memory, 256);
+        bytes += 256;
+    }
+    return (long) (bytes - buffer);
+}
+
+//
+// Restore a snapshot taken by savesnapshot. The cpu must have the same RAM 
+// pages mapped (the memory arrays may be different ones), the rest of the bus,
+// the devices and the events are left alone. Drops the block cache, as the 
+// code changed. Returns -1 if buffer does not hold a snapshot of this version
+// or the RAM pages do not match, or if a fork runs out of memory for its 
+// pages (the state is then partly restored), 0 otherwise.
+//
+int loadsnapshot(struct microprocessor *cpu, const unsigned char *buffer, unsigned long size)
+{
+    const unsigned char *bytes = buffer + SNAPSHOT_HEADERSIZE;
+    unsigned char *memory;
+    unsigned long long cycles = 0;
+    int page, i;
+
+    if (size < SNAPSHOT_HEADERSIZE || memcmp(buffer, SNAPSHOT_MAGIC, 8)) return -1;
+    if ((buffer[8] | buffer[9] << 8) != SNAPSHOT_VERSION) return -1;
+    if (size < snapshotsize(cpu)) return -1;
+    for (page = 0; page < 256; page++) {
+        if (!rampage(cpu, page) != !(buffer[32 + (page >> 3)] & (1 << (page & 7)))) return -1;
+    }
+    cpu->a = buffer[10];
+    cpu->x = buffer[11];
+    cpu->y = buffer[12];
+    cpu->sp = buffer[13];
+    cpu->pc = (unsigned short) (buffer[14] | buffer[15] << 8);
+    cpu->status = buffer[16];
+    cpu->nmiline = buffer[17];
+    cpu->signals = buffer[18];
+    cpu->irqlines = 0;
+    for (i = 0; i < 4; i++) cpu->irqlines |= (unsigned int) buffer[20 + i] << (8 * i);
+    for (i = 0; i < 8; i++) cycles |= (unsigned long long) buffer[24 + i] << (8 * i);
+    cpu->cycles = (unsigned long) cycles;
+    flushblocks(cpu);
+    for (page = 0; page < 256; page++) {
+        memory = rampage(cpu, page);
+        if (!memory) continue;
+        // a page a fork shares with its parent is only copied if it changes
+        if (cpu->bus.io[page].write != cowwrite) memcpy(memory, bytes, 256);
+        else if (memcmp(memory, bytes, 256)) {
+            memory = copypage(cpu, page);
+            if (!memory) return -1;
+            memcpy(memory, bytes, 256);
+        }
+        bytes += 256;
+    }
+    return 0;
+}
+
+//
+// Start caching decoded blocks in cache, owned by the user code (it takes 
+// about 500K, so allocate it with malloc). A NULL cache stops the caching.
+//
+void setblockcache(struct microprocessor *cpu, struct blockcache *cache)
+{
+    int i;
+
+    setjit(cpu, 0);
+    flushblocks(cpu);
+    cpu->blocks = cache;
+    if (!cache) return;
+    for (i = 0; i < BLOCK_ENTRIES; i++) cache->blocks[i].count = 0;
+    for (i = 0; i < 256; i++) {
+        cache->generation[i] = 0;
+        cache->memory[i] = 0;
+    }
+    for (i = 0; i < 8192; i++) cache->code[i] = 0;
+    cpu->breakblock = 0;
+    cache->jitcode = 0;
+    cache->jitsize = 0;
+    cache->jitused = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->invalidations = 0;
+    cache->compiled = 0;
+}
+
+//
+// Drop all the decoded blocks and map the protected pages back as RAM. The 
+// writes of the cpu keep the cache up to date, but the user code must call 
+// this after changing the memory arrays directly.
+//
+void flushblocks(struct microprocessor *cpu)
+{
+    struct blockcache *cache = cpu->blocks;
+    int page, i;
+
+    if (!cache) return;
+    for (page = 0; page < 256; page++) {
+        if (cache->memory[page]) {
+            cpu->bus.writepage[page] = cache->memory[page];
+            cpu->bus.io[page] = cache->io[page];
+            cache->memory[page] = 0;
+        }
+        cache->generation[page]++;
+    }
+    for (i = 0; i < 8192; i++) cache->code[i] = 0;
+    cpu->breakblock = 1;
+}
+
+//
+// Give the block cache a JIT code buffer of size bytes, allocated with mmap
+// as it must be executable. A size of 0 frees the buffer. Returns -1 when
+// there is no block cache, the buffer can not be allocated or the library
+// was not built with JIT.
+//
+int setjit(struct microprocessor *cpu, unsigned long size)
+{
+#ifdef JIT
+    struct blockcache *cache = cpu->blocks;
+    void *code;
+    int i;
+
+    if (!cache) return -1;
+    if (cache->jitcode) munmap(cache->jitcode, cache->jitsize);
+    for (i = 0; i < BLOCK_ENTRIES; i++) cache->blocks[i].native = 0;
+    cache->jitcode = 0;
+    cache->jitsize = 0;
+    cache->jitused = 0;
+    if (!size) return 0;
+    if (size < 2 * JIT_BLOCKSIZE) size = 2 * JIT_BLOCKSIZE;
+    code = mmap(0, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return -1;
+    cache->jitcode = code;
+    cache->jitsize = size;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+//
+// Switch the cycle exact engine on or off. It can be switched between two
+// calls to the run functions.
+//
+void setcycleexact(struct microprocessor *cpu, int exact)
+{
+    cpu->exact = exact != 0;
+}
+
+//
+// Call handler with context when cpu->cycles reaches when, between two 
+// opcodes (the opcode running at that cycle is finished first). The order of
+// events due at the same cycle is not defined. May be called from a bus or 
+// event handler while the cpu runs, the run then carries on after the event.
+// Returns -1 when the queue is full, 0 otherwise.
+//
+int schedule(struct microprocessor *cpu, unsigned long when, eventhandler handler, void *context)
+{
+    struct scheduler *events = &cpu->events;
+
+    if (events->count == EVENT_SLOTS) return -1;
+    events->heap[events->count].when = when;
+    events->heap[events->count].handler = handler;
+    events->heap[events->count].context = context;
+    siftup(events, events->count);
+    events->count++;
+    events->next = events->heap[0].when;
+    if (when < cpu->deadline) {
+        cpu->deadline = when;
+        cpu->breakblock = 1;
+    }
+    return 0;
+}
+
+//
+// Remove the events scheduled with handler and context, e.g. when a device 
+// is reprogrammed before its event is due. Returns the number of events 
+// removed.
+//
+int cancelevent(struct microprocessor *cpu, eventhandler handler, void *context)
+{
+    struct scheduler *events = &cpu->events;
+    unsigned int i, kept = 0;
+    int removed = 0;
+
+    for (i = 0; i < events->count; i++) {
+        if (events->heap[i].handler == handler && events->heap[i].context == context) removed++;
+        else events->heap[kept++] = events->heap[i];
+    }
+    events->count = kept;
+    for (i = kept / 2; i > 0; i--) siftdown(events, i - 1);
+    events->next = kept ? events->heap[0].when : ULONG_MAX;
+    return removed;
+}
+
+//
+// Make cpu a fork of parent: the same registers, cycle counter, interrupt 
+// lines, diagnostic handler and bus, with the RAM pages of the parent shared
+// until the fork writes to them (copy on write, 256 bytes at a time), so a
+// fork only takes memory for the pages it writes. The trace, profile, block
+// cache and events are not inherited, and the I/O pages keep the handlers 
+// and contexts of the parent, map them again to give the fork devices of 
+// its own. The parent must not write to its RAM while it has forks, and a 
+// fork must be released with initbus (or initcpu) to free its pages, before
+// its parent. The run stops, losing the write, if there is no memory for a
+// page.
+//
+void forkcpu(struct microprocessor *cpu, struct microprocessor *parent)
+{
+    unsigned char *memory;
+    int page, i;
+
+    *cpu = *parent;
+    cpu->blocks = 0;
+    settrace(cpu, 0, 0);
+    setprofile(cpu, 0);
+    setdiagnostics(cpu, parent->diag.handler, parent->diag.context, parent->diag.limit, parent->diag.window);
+    cpu->events.next = ULONG_MAX;
+    cpu->events.count = 0;
+    for (i = 0; i < 32; i++) cpu->forked[i] = 0;
+    for (page = 0; page < 256; page++) {
+        memory = rampage(parent, page);
+        if (!memory) continue;
+        cpu->bus.readpage[page] = memory;
+        cpu->bus.writepage[page] = 0;
+        cpu->bus.io[page].read = openbusread;
+        cpu->bus.io[page].write = cowwrite;
+        cpu->bus.io[page].context = cpu;
+    }
 }
@@ -20,19 +20,273 @@
 #ifndef MOS_H
 #define MOS_H
 
-// #define DEBUG 1
-
-#define STATUS_TO_BINARY_PATTERN "     Ne %c Ov %c NA %c Br %c De %c In %c Ze %c Ca %c\n"
-#define STATUS_TO_BINARY(byte)  \
-  (byte & 0x80 ? '1' : '0'), \
-  (byte & 0x40 ? '1' : '0'), \
-  (byte & 0x20 ? '1' : '0'), \
-  (byte & 0x10 ? '1' : '0'), \
-  (byte & 0x08 ? '1' : '0'), \
-  (byte & 0x04 ? '1' : '0'), \
-  (byte & 0x02 ? '1' : '0'), \
-  (byte & 0x01 ? '1' : '0')
+//
+// Memory bus. The 64K address space is split in 256 pages of 256 bytes. Each 
+// page is either backed by host memory, which the cpu reads and writes directly
+// through readpage/writepage, or by handler functions (usually I/O devices), 
+// used when the page pointer is NULL. Reads and writes are mapped separately, 
+// so a ROM page is direct for reads and goes to a handler for writes.
+//
+typedef unsigned char (*readhandler)(void *context, unsigned short address);
+typedef void (*writehandler)(void *context, unsigned short address, unsigned char value);
+
+struct iopage {
+    readhandler read;
+    writehandler write;
+    void *context;
+};
+
+struct bus {
+    unsigned char *readpage[256];
+    unsigned char *writepage[256];
+    struct iopage io[256];
+};
+
+//
+// Diagnostic events, raised when the cpu runs an opcode that real software 
+// should not normally use. Every event is counted in the cpu context. Events
+// are also passed to the handler, if one is set, up to limit events per 
+// window of cycles (limit 0 means no limit). The handler receives the opcode
+// and the address it was read from.
+//
+#define DIAG_UNDOCUMENTED 0     // stable undocumented opcode
+#define DIAG_NOP 1              // undocumented nop
+#define DIAG_JAM 2              // JAM opcode, executed as a nop
+#define DIAG_UNSTABLE 3         // unstable undocumented opcode
+#define DIAG_UNIMPLEMENTED 4    // opcode not implemented, executed as a nop
+#define DIAG_KINDS 5
+
+typedef void (*diaghandler)(void *context, unsigned char opcode, unsigned short pc, int kind);
+
+struct diagnostics {
+    diaghandler handler;
+    void *context;
+    unsigned long limit;
+    unsigned long window;
+    unsigned long windowstart;
+    unsigned long reported;
+    unsigned long dropped;
+    unsigned long count[DIAG_KINDS];
+};
+
+//
+// Opcode table. opcodeinfo describes each of the 256 opcodes as the library
+// executes it: the mnemonic (an index in opcodenames), the addressing mode,
+// the base cycles, and in flags the size in bytes and the OPCODE_ flags.
+// OPCODE_PENALTY opcodes take one more cycle when their index crosses a page.
+// The opcodes run as nops take no operand and have MODE_IMP. An entry takes
+// 4 bytes, so the table is 16 cache lines. The engines, the block cache, the
+// JIT and the tools all work from this table.
+//
+#define MODE_IMP 0              // implied, also the accumulator
+#define MODE_IMM 1
+#define MODE_REL 2
+#define MODE_ZP  3
+#define MODE_ZPX 4
+#define MODE_ZPY 5
+#define MODE_ABS 6
+#define MODE_ABX 7
+#define MODE_ABY 8
+#define MODE_IND 9
+#define MODE_IZX 10
+#define MODE_IZY 11
+#define MODE_COUNT 12
+
+#define OPCODE_SIZE 0x03        // mask of the size in bytes
+#define OPCODE_PENALTY 0x04     // one more cycle on a page crossing
+#define OPCODE_UNDOCUMENTED 0x08
+#define OPCODE_UNSTABLE 0x10
+#define OPCODE_JAM 0x20
+#define OPCODE_UNIMPLEMENTED 0x40
+
+struct opcodeinfo {
+    unsigned char mnemonic;
+    unsigned char mode;
+    unsigned char cycles;
+    unsigned char flags;
+};
+
+extern const struct opcodeinfo opcodeinfo[256];
+extern const char opcodenames[][4];
+
+//
+// Disassembler. disassemble decodes a buffer of code into one disasmop per
+// opcode, 6 bytes each, and formatopcode writes the text of a decoded 
+// opcode (at most DISASM_TEXTSIZE bytes with the terminating 0). The opcodes
+// are decoded as the library runs them (see opcodeinfo).
+//
+#define DISASM_TEXTSIZE 16
+
+struct disasmop {
+    unsigned short pc;              // address of the opcode
+    unsigned short operand;         // operand, or target of a branch
+    unsigned char opcode;
+    unsigned char size;             // bytes of the opcode and operand
+};
+
+//
+// Binary trace. When a trace buffer is set with settrace, the cpu writes one
+// record per opcode executed, overwriting the oldest records when the buffer
+// is full. The registers are the ones after the opcode, and address is only 
+// meaningful for opcodes with a memory operand. savetrace writes the records
+// to a file that tracedump6502 decodes offline.
+//
+#define TRACE_MAGIC "6502TRC1"
+#define TRACE_RECORDSIZE 16
 
+struct tracerecord {
+    unsigned int cycles;            // low 32 bits of cpu.cycles
+    unsigned short pc;              // address of the opcode
+    unsigned short address;         // address referenced by the opcode
+    unsigned char opcode;
+    unsigned char operand[2];
+    unsigned char a;
+    unsigned char x;
+    unsigned char y;
+    unsigned char sp;
+    unsigned char status;
+};
+
+struct trace {
+    struct tracerecord *records;    // NULL when the trace is off
+    unsigned long mask;             // number of records - 1
+    unsigned long count;            // records written since settrace
+};
+
+//
+// Execution profile. While a profile is set with setprofile, the cpu counts
+// the opcodes executed and the cycles spent at each address and by each 
+// opcode, and the same for each call stack, in a tree of the calls (jsr, brk
+// and interrupts) made since the profile was set. saveprofile writes the 
+// flat profile and savestacks the stacks, in the folded format read by the 
+// flame graph tools.
+//
+#define PROFILE_NODES 4096
+#define PROFILE_DEPTH 128
+
+struct profilenode {
+    unsigned short address;         // address called
+    int parent;                     // node of the caller, -1 for the root
+    int next;                       // next node in the same hash bucket
+    unsigned long count;            // opcodes executed in the call itself
+    unsigned long cycles;           // cycles spent in the call itself
+};
+
+struct profile {
+    unsigned long count[65536];     // opcodes executed at each address
+    unsigned long cycles[65536];    // cycles spent at each address
+    unsigned long opcodecount[256];
+    unsigned long opcodecycles[256];
+    unsigned long last;             // cpu.cycles after the last opcode
+    unsigned short next;            // pc after the last opcode
+    unsigned char lastsp;           // sp after the last opcode
+    struct profilenode nodes[PROFILE_NODES];
+    int hash[PROFILE_NODES];
+    int nodecount;
+    int frames[PROFILE_DEPTH];      // nodes of the calls in progress, the root first
+    unsigned char sp[PROFILE_DEPTH]; // sp right after each of these calls
+    int depth;
+    unsigned long lost;             // calls counted in their caller, the tree being full
+};
+
+//
+// Snapshots. savesnapshot writes the registers, the cycle counter, the state
+// of the interrupt lines and the RAM pages (the pages mapped with mapmemory)
+// to a buffer of snapshotsize bytes, in a fixed little endian layout starting
+// with SNAPSHOT_MAGIC and SNAPSHOT_VERSION. loadsnapshot restores it into a 
+// cpu with the same RAM pages mapped.
+//
+#define SNAPSHOT_MAGIC "6502SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADERSIZE 64
+
+//
+// Block cache. When a cache is set with setblockcache, the run loop decodes
+// the opcodes from each pc up to the next jump or branch (a basic block) once,
+// into an array of opcodes with their operands and base cycles, and then runs
+// the decoded block every time the pc gets there again. The cache is direct 
+// mapped by pc. The RAM pages holding cached code are write protected through
+// the bus, so a write to a decoded byte invalidates the blocks of its page.
+// On a JIT build (see setjit) the blocks run often enough are also compiled
+// to host code, kept in a buffer owned by the cache.
+//
+#define BLOCK_OPS 16
+#define BLOCK_ENTRIES 4096
+
+struct blockop {
+    unsigned short operand;
+    unsigned short next;            // pc after the opcode
+    unsigned char opcode;
+    unsigned char cycles;
+};
+
+struct microprocessor;
+typedef int (*nativeblock)(struct microprocessor *cpu);  // returns opcodes run
+
+struct block {
+    unsigned short pc;              // address of the first opcode
+    unsigned char count;            // opcodes in the block, 0 if empty
+    unsigned char page[2];          // first and last page of the code
+    unsigned int generation[2];     // generation of those pages when decoded
+    unsigned short maxcycles;       // most cycles the block can take
+    unsigned short runs;            // times run since decoded
+    nativeblock native;             // JIT compiled code, NULL if none
+    struct blockop op[BLOCK_OPS];
+};
+
+struct blockcache {
+    struct block blocks[BLOCK_ENTRIES];
+    unsigned int generation[256];   // incremented when a page is invalidated
+    unsigned char code[8192];       // one bit per address decoded in a block
+    unsigned char *memory[256];     // write protected pages, NULL if not
+    struct iopage io[256];          // handlers of those pages before
+    unsigned char *jitcode;         // JIT code buffer, NULL if none
+    unsigned long jitsize;          // bytes in the buffer
+    unsigned long jitused;          // bytes taken by compiled blocks
+    unsigned long hits;             // blocks found in the cache
+    unsigned long misses;           // blocks decoded
+    unsigned long invalidations;    // pages invalidated by a write to code
+    unsigned long compiled;         // blocks compiled by the JIT
+};
+
+//
+// Event scheduler. Devices schedule a handler to be called when cpu.cycles
+// reaches a given cycle (e.g. a timer underflow or the end of a video line).
+// The events are kept in a binary heap ordered by cycle, and next holds the
+// cycle of the earliest one (ULONG_MAX when there is none), so the run loop
+// only has to stop at that cycle instead of checking every opcode.
+//
+#define EVENT_SLOTS 32
+
+typedef void (*eventhandler)(void *context, unsigned long when);
+
+struct event {
+    unsigned long when;             // cycle the event is due
+    eventhandler handler;
+    void *context;
+};
+
+struct scheduler {
+    unsigned long next;             // cycle of heap[0], ULONG_MAX if empty
+    unsigned int count;             // events in the heap
+    struct event heap[EVENT_SLOTS];
+};
+
+//
+// CPU context. Every emulated machine owns one of these and passes a pointer
+// to it to the library functions, so any number of machines can run in the
+// same process. The fields between cycles and bus are scratch used by the 
+// library while executing opcodes and should not be touched by the user code.
+// The zresult, nresult, carry and overflow fields hold the flags while a 
+// LAZYFLAGS build is running opcodes, cpu->status is always up to date when
+// the library returns. The irqlines and nmiline fields hold the interrupt 
+// lines set with setirq and setnmi, and signals what the run loop has to do
+// about them. The bus, diag, trace, profile, blocks, exact and events fields
+// are set up with the functions below, the user code may read the diag 
+// counters, trace.count, the profile counters, the block cache statistics 
+// and events.next. forked marks the RAM pages a fork (see forkcpu) has 
+// copied for itself.
+//
 struct microprocessor {
 	unsigned char a;
 	unsigned char x;
@@ -41,14 +295,106 @@ struct microprocessor {
     unsigned short pc;
 	unsigned char status;
     unsigned long cycles;
-} cpu;
 
-unsigned int used;
+    unsigned char bordercross;
+    unsigned short address;
+    unsigned char stopped;
+    unsigned char breakblock;
+    unsigned long deadline;
+    unsigned char pending;
+    unsigned short partial;
+
+    unsigned char running;
+    unsigned char zresult;
+    unsigned char nresult;
+    unsigned char carry;
+    unsigned char overflow;
+
+    unsigned int irqlines;
+    unsigned char nmiline;
+    unsigned char signals;
+
+    struct bus bus;
+    struct diagnostics diag;
+    struct trace trace;
+    struct profile *profile;
+    struct blockcache *blocks;
+    unsigned char exact;
+    struct scheduler events;
+    unsigned char forked[32];
+};
+
+//
+// Result of a run loop: cycles and opcodes executed, and why it stopped.
+//
+#define STOP_CYCLES 0
+#define STOP_INSTRUCTIONS 1
+#define STOP_REQUESTED 2
+
+struct runresult {
+    unsigned long cycles;
+    unsigned long instructions;
+    int reason;
+};
+
+void initcpu(struct microprocessor *cpu);
+int processcommand(struct microprocessor *cpu);
+struct runresult runcycles(struct microprocessor *cpu, unsigned long budget);
+struct runresult runinstructions(struct microprocessor *cpu, unsigned long count);
+void stoprun(struct microprocessor *cpu);
+int runbatch(struct microprocessor **cpus, struct runresult *results, int count, int threads, unsigned long slice, unsigned long budget);
+unsigned long runlockstep(struct microprocessor **cpus, struct runresult *results, int count, unsigned long budget);
+void interrupt(struct microprocessor *cpu);
+void nmi(struct microprocessor *cpu);
+void setirq(struct microprocessor *cpu, unsigned int source, int level);
+void setnmi(struct microprocessor *cpu, int level);
+
+void initbus(struct microprocessor *cpu);
+void mapmemory(struct microprocessor *cpu, unsigned char page, unsigned int pages, unsigned char *memory);
+void maprom(struct microprocessor *cpu, unsigned char page, unsigned int pages, unsigned char *memory);
+void mapio(struct microprocessor *cpu, unsigned char page, unsigned int pages, readhandler read, writehandler write, void *context);
+
+void setdiagnostics(struct microprocessor *cpu, diaghandler handler, void *context, unsigned long limit, unsigned long window);
+void printdiagnostic(void *context, unsigned char opcode, unsigned short pc, int kind);
+
+unsigned long disassemble(const unsigned char *buffer, unsigned long length, unsigned short origin, struct disasmop *ops);
+int formatopcode(const struct disasmop *op, char *text);
+
+void settrace(struct microprocessor *cpu, struct tracerecord *records, unsigned long size);
+long savetrace(struct microprocessor *cpu, const char *filename);
+void setprofile(struct microprocessor *cpu, struct profile *profile);
+long saveprofile(struct microprocessor *cpu, const char *filename);
+long savestacks(struct microprocessor *cpu, const char *filename);
+
+unsigned long snapshotsize(struct microprocessor *cpu);
+long savesnapshot(struct microprocessor *cpu, unsigned char *buffer, unsigned long size);
+int loadsnapshot(struct microprocessor *cpu, const unsigned char *buffer, unsigned long size);
+void forkcpu(struct microprocessor *cpu, struct microprocessor *parent);
+
+void setblockcache(struct microprocessor *cpu, struct blockcache *cache);
+void flushblocks(struct microprocessor *cpu);
+int setjit(struct microprocessor *cpu, unsigned long size);
+void setcycleexact(struct microprocessor *cpu, int exact);
+
+int schedule(struct microprocessor *cpu, unsigned long when, eventhandler handler, void *context);
+int cancelevent(struct microprocessor *cpu, eventhandler handler, void *context);
+
+//
+// Bus access used by the cpu. Direct pages are read and written inline, only
+// I/O pages pay a call to the handler.
+//
+static inline unsigned char readmemory(struct microprocessor *cpu, unsigned short address)
+{
+    unsigned char *page = cpu->bus.readpage[address >> 8];
+    if (__builtin_expect(page != 0, 1)) return page[address & 0xFF];
+    return cpu->bus.io[address >> 8].read(cpu->bus.io[address >> 8].context, address);
+}
 
-int processcommand();
-void interrupt();
-void nmi();
-extern unsigned char readmemory(unsigned short);
-extern void writememory(unsigned short, unsigned char);
+static inline void writememory(struct microprocessor *cpu, unsigned short address, unsigned char value)
+{
+    unsigned char *page = cpu->bus.writepage[address >> 8];
+    if (__builtin_expect(page != 0, 1)) page[address & 0xFF] = value;
+    else cpu->bus.io[address >> 8].write(cpu->bus.io[address >> 8].context, address, value);
+}
 
 #endif
@@ -0,0 +1,134 @@
+//
+// 6502 emulator written in C
+//
+// An education project for me to learn about 6502 emulation
+//
+// Maybe a long term goal of extending this into an apple 2 emulator
+//
+// This program measures the batch runner. It loads the Klaus2m5 functional
+// test once (6502_functional_test.bin, see test6502.c), forks a number of
+// instances of it and runs them all to the end with runbatch, first on one
+// thread and then on twice as many threads each time, up to one per core.
+// The total emulated speed should grow with the number of threads. With -l
+// the instances are run once with runlockstep instead, on one thread.
+//
+//    usage: batch6502 [-l] [instances] [threads]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "6502.h"
+
+#define FRAME 20000
+#define SLICE 1000000
+#define BUDGET 1000000000UL
+
+unsigned char memory[65536];
+struct microprocessor base;
+
+//
+// Read binary file in memory
+//
+int rominit()
+{
+    FILE *fp;
+    int result;
+    printf ("Reading memory file ./6502_functional_test.bin\n");
+    fp = fopen ( "6502_functional_test.bin", "r" );
+    if ( fp == NULL ) return 8;
+    result = fread (&memory,1,65536,fp);
+    fclose(fp);
+    printf ("file size read %d\n", result);
+    return 0;
+}
+
+//
+// Event of each instance, called every frame of 20000 cycles. When we reach
+// test F0 the instance has finished the test suite.
+//
+void checktest(void *context, unsigned long when)
+{
+    struct microprocessor *cpu = context;
+
+    if (readmemory(cpu, 0x200) == 0xF0) stoprun(cpu);
+    else schedule(cpu, when + FRAME, checktest, cpu);
+}
+
+int main(int argc, char *argv[])
+{
+    struct timeval start,stop;
+    struct microprocessor *cpus, **list;
+    struct runresult *results;
+    unsigned long total, instructions, vector = 0;
+    long micros;
+    int lockstep = argc > 1 && !strcmp(argv[1], "-l");
+    int instances;
+    int maxthreads;
+    int threads, used, failed, i;
+
+    if (lockstep) {
+        argc--;
+        argv++;
+    }
+    instances = argc > 1 ? atoi(argv[1]) : 16;
+    maxthreads = lockstep ? 1 : argc > 2 ? atoi(argv[2]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (rominit()!=0) {
+        printf( "Could not open binary test file\n" ) ;
+        printf( "This program requires the file 6502_functional_test.bin (see README for link to download)\n");
+        return 0;
+    }
+    if (instances < 1) instances = 1;
+    if (maxthreads < 1) maxthreads = 1;
+
+    //
+    // The instances are forks of a single cpu set up as in test6502, so they
+    // share the memory of the test and only copy the pages they write
+    //
+    initcpu(&base);
+    base.sp = 0xFF;
+    base.pc = 0x0400;
+    mapmemory(&base, 0x00, 256, memory);
+    cpus = malloc(instances * sizeof *cpus);
+    list = malloc(instances * sizeof *list);
+    results = malloc(instances * sizeof *results);
+    if (!cpus || !list || !results) return 1;
+
+    printf ("Running %d instances of the test, please wait a bit\n", instances);
+    for (threads = 1; ; threads *= 2) {
+        if (threads > maxthreads) threads = maxthreads;
+        for (i = 0; i < instances; i++) {
+            forkcpu(&cpus[i], &base);
+            schedule(&cpus[i], FRAME, checktest, &cpus[i]);
+            list[i] = &cpus[i];
+        }
+
+        gettimeofday(&start, NULL);
+        if (lockstep) {
+            vector = runlockstep(list, results, instances, BUDGET);
+            used = 1;
+        }
+        else used = runbatch(list, results, instances, threads, SLICE, BUDGET);
+        gettimeofday(&stop, NULL);
+        micros = (stop.tv_sec - start.tv_sec) * 1000000 + stop.tv_usec - start.tv_usec;
+        if (micros < 1) micros = 1;
+
+        total = 0;
+        instructions = 0;
+        failed = 0;
+        for (i = 0; i < instances; i++) {
+            total += results[i].cycles;
+            instructions += results[i].instructions;
+            if (results[i].reason != STOP_REQUESTED) failed++;
+            initbus(&cpus[i]);      // frees the pages copied by the fork
+        }
+        printf ("%3d threads: %lu cycles in %ld us, %ld Mhz", used, total, micros, (long) (total/micros));
+        if (lockstep) printf (", %lu%% of the opcodes in lockstep", instructions ? vector * 100 / instructions : 0);
+        if (failed) printf (", %d instances did not finish the test", failed);
+        printf ("\n");
+        if (threads == maxthreads) break;
+    }
+    return 0;
+}
@@ -0,0 +1,606 @@
+//
+// 6502 emulator written in C
+//
+// An education project for me to learn about 6502 emulation
+//
+// Maybe a long term goal of extending this into an apple 2 emulator
+//
+// This program is the benchmark of the library. It runs a fixed set of
+// workloads a number of times each and prints, for each workload, the
+// median and p99 emulated speed (p99 is the speed 99% of the runs reach,
+// the slowest run when there are fewer than 100), the host time per
+// emulated opcode and the opcodes per second. The output has one line per
+// workload with the same columns every time, and comment lines starting
+// with #, so the results of two builds can be compared with a script to
+// find regressions.
+//
+// The workloads are the Klaus2m5 functional and decimal tests, when their
+// binary files are in the current directory (see test6502.c and
+// testdecimal6502.c), and small loops on a 64K RAM doing arithmetic,
+// copying memory, taking data dependent branches and running undocumented
+// opcodes. Each run starts from a fresh cpu and memory, the first run of
+// each workload warms up the host caches and is not counted.
+//
+// With -o it times each opcode on its own instead, see benchopcodes. With -p
+// it also reads the performance counters of the host, see opencounters.
+//
+//    usage: bench6502 [-o] [-p] [runs] [blocks|jit|exact]
+//
+// The last argument selects the engine as in test6502.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "6502.h"
+
+#define FRAME 20000
+#define LOOPCYCLES 50000000UL
+#define MAXRUNS 1000
+
+unsigned char memory[65536];
+unsigned char functional[65536];
+unsigned char decimal[258];
+int hasfunctional, hasdecimal;
+
+struct microprocessor cpu;
+struct blockcache *cache;
+const char *engine = "default";
+
+//
+// Host performance counters, read with perf_event_open on Linux around each
+// measured run and printed per emulated opcode: host cycles, instructions, 
+// branch misses (mostly the dispatch of the opcodes) and L1 instruction and
+// data cache misses. They count this thread in user mode only, so they 
+// measure the library and not the kernel, and are scaled when the kernel 
+// shares the hardware counters between them. The counters the host does not
+// have are printed as -.
+//
+#ifdef __linux__
+#define HOST_COUNTERS
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define COUNTERS 5
+
+const char *counternames[COUNTERS] = { "hostcycles", "hostinstrs", "brmisses", "l1imisses", "l1dmisses" };
+int counterfds[COUNTERS] = { -1, -1, -1, -1, -1 };
+double counted[COUNTERS];       // events counted by the runs kept
+int counting;
+
+//
+// The loops, assembled at 0x0400 and run for LOOPCYCLES cycles
+//
+
+// arithmetic and logic on the accumulator, with the result stored
+const unsigned char aluloop[] = {
+    0xA2, 0x00,             // 0400 ldx #$00
+    0x18,                   // 0402 clc
+    0x8A,                   // 0403 txa
+    0x69, 0x37,             // 0404 adc #$37
+    0x29, 0xF3,             // 0406 and #$F3
+    0x49, 0x5A,             // 0408 eor #$5A
+    0x09, 0x01,             // 040A ora #$01
+    0x0A,                   // 040C asl a
+    0x6A,                   // 040D ror a
+    0xC9, 0x80,             // 040E cmp #$80
+    0xE9, 0x11,             // 0410 sbc #$11
+    0x85, 0x10,             // 0412 sta $10
+    0xE8,                   // 0414 inx
+    0x4C, 0x02, 0x04        // 0415 jmp $0402
+};
+
+// copy of the 4K at 0x1000 to 0x2000, through pointers in page zero
+const unsigned char copyloop[] = {
+    0xA9, 0x00, 0x85, 0x00, // 0400 lda #$00, sta $00
+    0xA9, 0x10, 0x85, 0x01, // 0404 lda #$10, sta $01
+    0xA9, 0x00, 0x85, 0x02, // 0408 lda #$00, sta $02
+    0xA9, 0x20, 0x85, 0x03, // 040C lda #$20, sta $03
+    0xA2, 0x10,             // 0410 ldx #$10
+    0xA0, 0x00,             // 0412 ldy #$00
+    0xB1, 0x00,             // 0414 lda ($00),y
+    0x91, 0x02,             // 0416 sta ($02),y
+    0xC8,                   // 0418 iny
+    0xD0, 0xF9,             // 0419 bne $0414
+    0xE6, 0x01,             // 041B inc $01
+    0xE6, 0x03,             // 041D inc $03
+    0xCA,                   // 041F dex
+    0xD0, 0xF2,             // 0420 bne $0414
+    0x4C, 0x00, 0x04        // 0422 jmp $0400
+};
+
+// branches on the bits of a linear feedback shift register
+const unsigned char branchloop[] = {
+    0xA9, 0xA5,             // 0400 lda #$A5
+    0x0A,                   // 0402 asl a
+    0x90, 0x02,             // 0403 bcc $0407
+    0x49, 0x1D,             // 0405 eor #$1D
+    0x30, 0x03,             // 0407 bmi $040C
+    0xC8,                   // 0409 iny
+    0xD0, 0xF6,             // 040A bne $0402
+    0xE8,                   // 040C inx
+    0x10, 0xF3,             // 040D bpl $0402
+    0x4C, 0x02, 0x04        // 040F jmp $0402
+};
+
+// undocumented opcodes on page zero and immediate values
+const unsigned char illegalloop[] = {
+    0xA7, 0x10,             // 0400 lax $10
+    0x87, 0x11,             // 0402 sax $11
+    0x07, 0x12,             // 0404 slo $12
+    0x27, 0x13,             // 0406 rla $13
+    0x47, 0x14,             // 0408 sre $14
+    0xC7, 0x15,             // 040A dcp $15
+    0x0B, 0x5A,             // 040C anc #$5A
+    0x4B, 0x3C,             // 040E alr #$3C
+    0x6B, 0xA5,             // 0410 arr #$A5
+    0xE6, 0x10,             // 0412 inc $10
+    0x4C, 0x00, 0x04        // 0414 jmp $0400
+};
+
+//
+// Read a binary file in a buffer, returns 0 when it can't be read
+//
+int loadfile(const char *name, unsigned char *buffer, int size)
+{
+    FILE *fp;
+    int result;
+
+    fp = fopen(name, "r");
+    if (fp == NULL) return 0;
+    result = fread(buffer, 1, size, fp);
+    fclose(fp);
+    return result > 0;
+}
+
+//
+// The final rts of the decimal test pulls its address from the empty stack,
+// see testdecimal6502.c
+//
+unsigned char stackread(void *context, unsigned short address)
+{
+    if (address < 0x102) stoprun(context);
+    return memory[address];
+}
+
+void stackwrite(void *context, unsigned short address, unsigned char value)
+{
+    memory[address] = value;
+}
+
+//
+// Fresh cpu with the whole 64K mapped to memory, on the engine selected
+//
+void boot(unsigned short pc)
+{
+    if (cpu.blocks) setblockcache(&cpu, 0);     // frees the JIT code of the last run
+    initcpu(&cpu);
+    cpu.sp = 0xFF;
+    cpu.pc = pc;
+    mapmemory(&cpu, 0x00, 256, memory);
+    if (cache) {
+        setblockcache(&cpu, cache);
+        if (!strcmp(engine, "jit")) setjit(&cpu, 1 << 20);
+    }
+    if (!strcmp(engine, "exact")) setcycleexact(&cpu, 1);
+}
+
+//
+// The workloads. Each one sets up the memory and the cpu, then runs and
+// returns the cycles and opcodes of the run.
+//
+struct runresult runfunctional()
+{
+    struct runresult result = { 0, 0, 0 }, frame;
+
+    memcpy(memory, functional, sizeof memory);
+    boot(0x0400);
+    while (memory[0x200] != 0xF0) {
+        frame = runcycles(&cpu, FRAME);
+        result.cycles += frame.cycles;
+        result.instructions += frame.instructions;
+    }
+    return result;
+}
+
+struct runresult rundecimal()
+{
+    struct runresult result = { 0, 0, 0 }, frame;
+
+    memset(memory, 0, sizeof memory);
+    memcpy(&memory[0x200], decimal, sizeof decimal);
+    boot(0x0200);
+    mapio(&cpu, 0x01, 1, stackread, stackwrite, &cpu);
+    while (cpu.pc >= 0x200) {
+        frame = runcycles(&cpu, FRAME);
+        result.cycles += frame.cycles;
+        result.instructions += frame.instructions;
+    }
+    return result;
+}
+
+struct runresult runloop(const unsigned char *code, int size)
+{
+    int i;
+
+    memset(memory, 0, sizeof memory);
+    for (i = 0x1000; i < 0x2000; i++) memory[i] = i * 7;
+    memcpy(&memory[0x0400], code, size);
+    boot(0x0400);
+    return runcycles(&cpu, LOOPCYCLES);
+}
+
+struct runresult runalu()     { return runloop(aluloop, sizeof aluloop); }
+struct runresult runcopy()    { return runloop(copyloop, sizeof copyloop); }
+struct runresult runbranch()  { return runloop(branchloop, sizeof branchloop); }
+struct runresult runillegal() { return runloop(illegalloop, sizeof illegalloop); }
+
+struct workload {
+    const char *name;
+    struct runresult (*run)();
+    int *available;
+};
+
+int always = 1;
+
+struct workload workloads[] = {
+    { "functional", runfunctional, &hasfunctional },
+    { "decimal", rundecimal, &hasdecimal },
+    { "alu", runalu, &always },
+    { "copy", runcopy, &always },
+    { "branch", runbranch, &always },
+    { "illegal", runillegal, &always },
+};
+
+//
+// Open the counters, returns the number opened. Prints why when none could 
+// be opened.
+//
+int opencounters()
+{
+#ifdef HOST_COUNTERS
+    static const unsigned long long configs[COUNTERS][2] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    };
+    struct perf_event_attr attr;
+    int opened = 0, error = 0, i;
+
+    for (i = 0; i < COUNTERS; i++) {
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = configs[i][0];
+        attr.config = configs[i][1];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counterfds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counterfds[i] >= 0) opened++;
+        else error = errno;
+    }
+    if (!opened) printf("# no host counters, perf_event_open failed: %s\n", strerror(error));
+    return opened;
+#else
+    printf("# no host counters, they need perf_event_open (Linux)\n");
+    return 0;
+#endif
+}
+
+void startcounters()
+{
+#ifdef HOST_COUNTERS
+    int i;
+
+    for (i = 0; i < COUNTERS; i++) {
+        if (counterfds[i] < 0) continue;
+        ioctl(counterfds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counterfds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+//
+// Stop the counters, and add what they counted to counted when keep is set
+//
+void stopcounters(int keep)
+{
+#ifdef HOST_COUNTERS
+    unsigned long long values[3];   // count, time enabled, time running
+    int i;
+
+    for (i = 0; i < COUNTERS; i++) {
+        if (counterfds[i] < 0) continue;
+        ioctl(counterfds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counterfds[i], values, sizeof values) != sizeof values || !keep) continue;
+        counted[i] += values[2] ? (double) values[0] * values[1] / values[2] : 0;
+    }
+#endif
+}
+
+void printcounters(const double *values)
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++) {
+        if (counterfds[i] < 0) printf(" %10s", "-");
+        else printf(" %10.3f", values[i]);
+    }
+}
+
+void printcounternames()
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++) printf(" %10s", counternames[i]);
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+//
+// Median of the values, which are sorted on the way
+//
+double median(double *values, int count)
+{
+    qsort(values, count, sizeof values[0], compare);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+void benchworkloads(int runs)
+{
+    static double seconds[MAXRUNS];
+    struct runresult result = { 0, 0, 0 };
+    struct workload *workload;
+    double start, middle, slow, perop[COUNTERS];
+    int i, c, w;
+
+    hasfunctional = loadfile("6502_functional_test.bin", functional, sizeof functional);
+    hasdecimal = loadfile("6502_decimal_test.bin", decimal, sizeof decimal);
+
+    printf("# bench6502 engine %s runs %d\n", engine, runs);
+    printf("# %-10s %12s %12s %10s %10s %10s %10s", "workload", "cycles", "opcodes", "mhz", "p99mhz", "ns/opcode", "mopcodes/s");
+    if (counting) printcounternames();
+    printf("\n");
+    for (w = 0; w < (int) (sizeof workloads / sizeof workloads[0]); w++) {
+        workload = &workloads[w];
+        if (!*workload->available) {
+            printf("# %s skipped, its binary file is missing\n", workload->name);
+            continue;
+        }
+        workload->run();
+        memset(counted, 0, sizeof counted);
+        for (i = 0; i < runs; i++) {
+            startcounters();
+            start = now();
+            result = workload->run();
+            seconds[i] = now() - start;
+            stopcounters(1);
+        }
+        if (cache) setblockcache(&cpu, 0);
+
+        //
+        // Every run of a workload executes the same opcodes, so the speeds
+        // follow from the times sorted from the fastest to the slowest
+        //
+        middle = median(seconds, runs);
+        slow = seconds[(runs * 99 + 99) / 100 - 1];
+        if (middle <= 0) middle = 1e-9;
+        if (slow <= 0) slow = 1e-9;
+        printf("%-12s %12lu %12lu %10.1f %10.1f %10.2f %10.1f", workload->name, result.cycles, result.instructions,
+               result.cycles / middle * 1e-6, result.cycles / slow * 1e-6,
+               middle * 1e9 / result.instructions, result.instructions / middle * 1e-6);
+        for (c = 0; c < COUNTERS; c++) perop[c] = counted[c] / ((double) runs * result.instructions);
+        if (counting) printcounters(perop);
+        printf("\n");
+    }
+}
+
+//
+// The opcodes in the order of opcodes.h, with their name, addressing mode 
+// and size taken from opcodeinfo
+//
+struct opcode {
+    int code;
+    const char *name;
+    const char *mode;
+    int size;
+};
+
+#define OPCODE(code, body) { code },
+struct opcode opcodes[] = {
+#include "opcodes.h"
+};
+#undef OPCODE
+
+void describe(struct opcode *op)
+{
+    static const char *modes[MODE_COUNT] = {
+        "", "imm", "rel", "zp", "zp,x", "zp,y", "abs", "abs,x", "abs,y", "(abs)", "(zp,x)", "(zp),y"
+    };
+    const struct opcodeinfo *info = &opcodeinfo[op->code];
+
+    op->name = opcodenames[info->mnemonic];
+    op->mode = modes[info->mode];
+    op->size = info->flags & OPCODE_SIZE;
+    // asl, lsr, rol and ror on the accumulator
+    if (info->mode == MODE_IMP && (op->code & 0x9F) == 0x0A) op->mode = "a";
+}
+
+#define COPIES 64
+#define OPCYCLES 1000000UL
+
+enum { PLAIN, CROSS, DECIMAL, TAKEN, UNTAKEN };
+const char *variants[] = { "", "cross", "decimal", "taken", "untaken" };
+
+//
+// Time an opcode in a loop of COPIES copies of it and a jmp back to the
+// first, or in a loop on itself for the opcodes going somewhere else than 
+// the next opcode (jmp, jsr, rts, rti and brk). The cpu starts with x and y
+// at 0x10, the page zero pointers at 0x2020 and the stack filled with 0x04, 
+// so rts returns to 0x0405 and rti to 0x0404. Operands point to page zero at
+// 0x70 and to 0x2000, or 0x20F8 when the variant crosses a page. Returns 
+// the host ns per opcode, without the jmp, and stores the emulated cycles
+// and the host counters per opcode.
+//
+double jmpns, jmpcounters[COUNTERS];
+
+double timeopcode(struct opcode *op, int variant, int runs, double *cycles, double *perop)
+{
+    static double ns[MAXRUNS];
+    struct runresult result;
+    unsigned short origin = 0x0400, operand = 0x5A, at;
+    unsigned char status = 0x20, flag;
+    double start, seconds, jumps, opcodes = 0, alljumps = 0;
+    int self = 0, i, c, copy;
+
+    if (!strcmp(op->mode, "rel")) operand = 0;
+    if (op->mode[0] == 'z' || op->mode[0] == '(') operand = 0x70;
+    if (!strncmp(op->mode, "abs", 3)) operand = variant == CROSS ? 0x20F8 : 0x2000;
+    if (!strcmp(op->name, "jmp") || !strcmp(op->name, "jsr") || !strcmp(op->name, "rts") || 
+        !strcmp(op->name, "rti") || !strcmp(op->name, "brk")) {
+        self = 1;
+        if (!strcmp(op->name, "rts")) origin = 0x0405;
+        if (!strcmp(op->name, "rti")) origin = 0x0404;
+        operand = !strcmp(op->mode, "(abs)") ? 0x0300 : origin;
+    }
+    if (variant == DECIMAL) status |= 0x08;
+    if (variant == TAKEN || variant == UNTAKEN) {
+        // bits 7 and 6 of the opcode select the flag, bit 5 the value taken
+        flag = (const unsigned char[]) { 0x80, 0x40, 0x01, 0x02 }[op->code >> 6];
+        if ((variant == TAKEN) == ((op->code & 0x20) != 0)) status |= flag;
+    }
+
+    for (i = -1; i < runs; i++) {
+        memset(memory, 0x20, 0x100);
+        memset(memory + 0x100, 0x04, 0x100);
+        memset(memory + 0x200, 0, 0xFE00);
+        memory[0x70] = variant == CROSS ? 0xF8 : 0x00;
+        memory[0x300] = origin & 0xFF;
+        memory[0x301] = origin >> 8;
+        memory[0xFFFE] = origin & 0xFF;
+        memory[0xFFFF] = origin >> 8;
+        for (copy = 0, at = origin; copy < (self ? 1 : COPIES); copy++, at += op->size) {
+            memory[at] = op->code;
+            if (op->size > 1) memory[at + 1] = operand & 0xFF;
+            if (op->size > 2) memory[at + 2] = operand >> 8;
+        }
+        if (!self) {
+            memory[at] = 0x4C;
+            memory[at + 1] = origin & 0xFF;
+            memory[at + 2] = origin >> 8;
+        }
+        boot(origin);
+        cpu.x = 0x10;
+        cpu.y = 0x10;
+        cpu.status = status;
+
+        if (i == 0) memset(counted, 0, sizeof counted);
+        startcounters();
+        start = now();
+        result = runcycles(&cpu, OPCYCLES);
+        seconds = now() - start;
+        stopcounters(i >= 0);
+        if (i < 0) continue;    // warm up
+
+        jumps = self ? 0 : (double) result.instructions / (COPIES + 1);
+        ns[i] = (seconds * 1e9 - jumps * jmpns) / (result.instructions - jumps);
+        *cycles = (result.cycles - jumps * 3) / (result.instructions - jumps);
+        opcodes += result.instructions - jumps;
+        alljumps += jumps;
+    }
+    if (cache) setblockcache(&cpu, 0);
+    for (c = 0; c < COUNTERS; c++) perop[c] = (counted[c] - alljumps * jmpcounters[c]) / opcodes;
+    return median(ns, runs);
+}
+
+//
+// One line per opcode and variant: the indexed opcodes with and without a
+// page crossing, adc, sbc and arr in binary and decimal mode, the branches 
+// taken and not taken
+//
+void benchopcodes(int runs)
+{
+    struct opcode *op, *jmp = 0;
+    double ns, cycles, perop[COUNTERS];
+    int count = sizeof opcodes / sizeof opcodes[0];
+    int i, v;
+
+    for (i = 0; i < count; i++) {
+        describe(&opcodes[i]);
+        if (opcodes[i].code == 0x4C) jmp = &opcodes[i];
+    }
+    if (jmp) jmpns = timeopcode(jmp, PLAIN, runs, &cycles, jmpcounters);
+
+    printf("# bench6502 opcodes engine %s runs %d\n", engine, runs);
+    printf("# op %-4s %-6s %-8s %6s %10s", "name", "mode", "variant", "cycles", "ns/opcode");
+    if (counting) printcounternames();
+    printf("\n");
+    for (op = opcodes; op < opcodes + count; op++) {
+        for (v = PLAIN; v <= UNTAKEN; v++) {
+            if (v == PLAIN && !strcmp(op->mode, "rel")) continue;
+            if (v == CROSS && strcmp(op->mode, "abs,x") && strcmp(op->mode, "abs,y") && strcmp(op->mode, "(zp),y")) continue;
+            if (v == DECIMAL && strcmp(op->name, "adc") && strcmp(op->name, "sbc") && strcmp(op->name, "arr")) continue;
+            if ((v == TAKEN || v == UNTAKEN) && strcmp(op->mode, "rel")) continue;
+            ns = timeopcode(op, v, runs, &cycles, perop);
+            printf("%02X   %-4s %-6s %-8s %6.2f %10.2f", op->code, op->name, op->mode, variants[v], cycles, ns);
+            if (counting) printcounters(perop);
+            printf("\n");
+        }
+    }
+}
+
+int usage()
+{
+    printf("usage: bench6502 [-o] [-p] [runs] [blocks|jit|exact]\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opcodes = 0;
+    int runs;
+
+    for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+        if (!strcmp(argv[1], "-o")) opcodes = 1;
+        else if (!strcmp(argv[1], "-p")) counting = 1;
+        else return usage();
+    }
+    runs = argc > 1 ? atoi(argv[1]) : opcodes ? 5 : 11;
+    if (runs < 1) runs = 1;
+    if (runs > MAXRUNS) runs = MAXRUNS;
+    if (argc > 2) engine = argv[2];
+    if (!strcmp(engine, "blocks") || !strcmp(engine, "jit")) {
+        cache = malloc(sizeof(struct blockcache));
+        if (!cache) return 1;
+        setblockcache(&cpu, cache);
+        if (!strcmp(engine, "jit") && setjit(&cpu, 1 << 20)) {
+            printf("Could not start the JIT, build the library with make DEFINES=-DJIT\n");
+            return 0;
+        }
+        setblockcache(&cpu, 0);
+    }
+    else if (strcmp(engine, "default") && strcmp(engine, "exact")) return usage();
+    if (counting && !opencounters()) counting = 0;
+
+    if (opcodes) benchopcodes(runs);
+    else benchworkloads(runs);
+    return 0;
+}
@@ -0,0 +1,106 @@
+//
+// 6502 emulator written in C
+//
+// An education project for me to learn about 6502 emulation
+//
+// Maybe a long term goal of extending this into an apple 2 emulator
+//
+// This program disassembles a binary file with disassemble and formatopcode,
+// one opcode per line with its address and bytes. The file is loaded at
+// origin (hex, 0 by default) and at most 64K are read. The opcodes are
+// decoded as the library runs them, so the opcodes it runs as nops take a
+// single byte. With -t nothing is printed, the file is disassembled many
+// times and the time of one pass is printed instead.
+//
+//    usage: dis6502 [-t] file [origin]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "6502.h"
+
+#define PASSES 1000
+
+unsigned char memory[65536];
+struct disasmop ops[65536];
+
+double now()
+{
+    struct timeval time;
+
+    gettimeofday(&time, NULL);
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+//
+// Time disassemble alone, then with the text of every opcode, over PASSES
+// passes on the file
+//
+void timepasses(unsigned long length, unsigned short origin)
+{
+    char text[DISASM_TEXTSIZE];
+    unsigned long count = 0, i;
+    double start, decode, format;
+    int pass, chars = 0;
+
+    start = now();
+    for (pass = 0; pass < PASSES; pass++) count = disassemble(memory, length, origin, ops);
+    decode = now() - start;
+    start = now();
+    for (pass = 0; pass < PASSES; pass++) {
+        count = disassemble(memory, length, origin, ops);
+        for (i = 0; i < count; i++) chars += formatopcode(&ops[i], text);
+    }
+    format = now() - start;
+    printf("%lu bytes, %lu opcodes, %d characters\n", length, count, chars / PASSES);
+    printf("disassemble:              %8.1f us per pass\n", decode * 1e6 / PASSES);
+    printf("disassemble and format:   %8.1f us per pass\n", format * 1e6 / PASSES);
+}
+
+int main(int argc, char *argv[])
+{
+    char text[DISASM_TEXTSIZE];
+    unsigned long length, count, i, at;
+    unsigned short origin = 0;
+    int timing = 0, j;
+    FILE *fp;
+
+    if (argc > 1 && !strcmp(argv[1], "-t")) {
+        timing = 1;
+        argc--;
+        argv++;
+    }
+    if (argc < 2 || argc > 3) {
+        printf("usage: dis6502 [-t] file [origin]\n");
+        return 1;
+    }
+    if (argc == 3) origin = (unsigned short) strtoul(argv[2], NULL, 16);
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        printf("Could not open file %s\n", argv[1]);
+        return 1;
+    }
+    length = fread(memory, 1, sizeof memory, fp);
+    fclose(fp);
+
+    if (timing) {
+        timepasses(length, origin);
+        return 0;
+    }
+    count = disassemble(memory, length, origin, ops);
+    at = 0;
+    for (i = 0; i < count; i++) {
+        formatopcode(&ops[i], text);
+        printf("%04X  ", ops[i].pc);
+        for (j = 0; j < 3; j++) {
+            if (j < ops[i].size) printf("%02X ", memory[at + j]);
+            else printf("   ");
+        }
+        printf(" %s\n", text);
+        at += ops[i].size;
+    }
+    // an opcode cut by the end of the file is listed as bytes
+    for (; at < length; at++) printf("%04X  %02X\n", (unsigned short) (origin + at), memory[at]);
+    return 0;
+}
@@ -0,0 +1,364 @@
+//
+//    This file is part of lib6502.
+//
+//    lib6502 is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    lib6502 is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with lib6502.  If not, see <https://www.gnu.org/licenses/>.
+//
+//    nelbr - Summer 2020
+//
+// List of the code executed for each of the 256 opcodes. This file has no
+// include guard on purpose: 6502.c defines OPCODE(code, body) and includes it
+// once for each dispatch engine (switch cases, computed goto labels and the
+// computed goto table), and bench6502.c includes it to list the opcodes it
+// times. Every opcode must be listed exactly once. The body
+// can use cpu and command (the opcode being executed), and reads its operand
+// with OPERAND8 or OPERAND16. The addressing mode is spelled out in each body
+// by calling the function of that mode, so no body depends on a runtime mode.
+// The base cycles, size and page crossing penalty of each opcode are in 
+// opcodeinfo (6502.c), the engines add the penalty after the body.
+// Undocumented opcodes call diagnostic before anything else, while the pc 
+// still points right after the opcode.
+//
+
+OPCODE(0x69, adc(cpu, OPERAND8))
+OPCODE(0x65, adc(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0x75, adc(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0x6D, adc(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0x7D, adc(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0x79, adc(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0x61, adc(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0x71, adc(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0x29, fand(cpu, OPERAND8))
+OPCODE(0x25, fand(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0x35, fand(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0x2D, fand(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0x3D, fand(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0x39, fand(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0x21, fand(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0x31, fand(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0x0A, asla(cpu))
+OPCODE(0x06, asl(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x16, asl(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x0E, asl(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x1E, asl(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0x90, bcc(cpu, OPERAND8))
+OPCODE(0xB0, bcs(cpu, OPERAND8))
+OPCODE(0xF0, beq(cpu, OPERAND8))
+OPCODE(0x30, bmi(cpu, OPERAND8))
+OPCODE(0xD0, bne(cpu, OPERAND8))
+OPCODE(0x10, bpl(cpu, OPERAND8))
+OPCODE(0x50, bvc(cpu, OPERAND8))
+OPCODE(0x70, bvs(cpu, OPERAND8))
+
+OPCODE(0x24, bit(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0x2C, bit(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+
+OPCODE(0x00, fbrk(cpu))
+
+OPCODE(0x18, clc(cpu))
+OPCODE(0xD8, cld(cpu))
+OPCODE(0x58, cli(cpu))
+OPCODE(0xB8, clv(cpu))
+
+OPCODE(0xC9, cmp(cpu, OPERAND8))
+OPCODE(0xC5, cmp(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xD5, cmp(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0xCD, cmp(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xDD, cmp(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0xD9, cmp(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0xC1, cmp(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0xD1, cmp(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0xE0, cpx(cpu, OPERAND8))
+OPCODE(0xE4, cpx(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xEC, cpx(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+
+OPCODE(0xC0, cpy(cpu, OPERAND8))
+OPCODE(0xC4, cpy(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xCC, cpy(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+
+OPCODE(0xC6, dec(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0xD6, dec(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0xCE, dec(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0xDE, dec(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0xCA, dex(cpu))
+OPCODE(0x88, dey(cpu))
+
+OPCODE(0x49, eor(cpu, OPERAND8))
+OPCODE(0x45, eor(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0x55, eor(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0x4D, eor(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0x5D, eor(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0x59, eor(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0x41, eor(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0x51, eor(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0xE6, inc(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0xF6, inc(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0xEE, inc(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0xFE, inc(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0xE8, inx(cpu))
+OPCODE(0xC8, iny(cpu))
+
+OPCODE(0x4C, jmp(cpu, OPERAND16))
+OPCODE(0x6C, jmp(cpu, indirect(cpu, OPERAND16)))
+
+OPCODE(0x20, jsr(cpu, OPERAND16))
+
+OPCODE(0xA1, lda(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0xA5, lda(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xA9, lda(cpu, OPERAND8))
+OPCODE(0xAD, lda(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xB1, lda(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+OPCODE(0xB5, lda(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0xBD, lda(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0xB9, lda(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+
+OPCODE(0xA2, ldx(cpu, OPERAND8))
+OPCODE(0xA6, ldx(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xB6, ldx(cpu, readmemory(cpu, zeropagey(cpu, OPERAND8))))
+OPCODE(0xAE, ldx(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xBE, ldx(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+
+OPCODE(0xA0, ldy(cpu, OPERAND8))
+OPCODE(0xA4, ldy(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xB4, ldy(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0xAC, ldy(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xBC, ldy(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+
+OPCODE(0x4A, lsra(cpu))
+OPCODE(0x46, lsr(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x56, lsr(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x4E, lsr(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x5E, lsr(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0xEA, nop(cpu, 0))
+
+OPCODE(0x09, ora(cpu, OPERAND8))
+OPCODE(0x05, ora(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0x15, ora(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0x0D, ora(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0x1D, ora(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0x19, ora(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0x01, ora(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0x11, ora(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0x48, pha(cpu))
+OPCODE(0x08, php(cpu))
+OPCODE(0x68, pla(cpu))
+OPCODE(0x28, plp(cpu))
+
+OPCODE(0x2A, rola(cpu))
+OPCODE(0x26, rol(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x36, rol(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x2E, rol(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x3E, rol(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0x6A, rora(cpu))
+OPCODE(0x66, ror(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x76, ror(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x6E, ror(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x7E, ror(cpu, absolutex(cpu, OPERAND16)))
+
+OPCODE(0x40, rti(cpu))
+
+OPCODE(0x60, rts(cpu))
+
+OPCODE(0xE9, sbc(cpu, OPERAND8))
+OPCODE(0xE5, sbc(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xF5, sbc(cpu, readmemory(cpu, zeropagex(cpu, OPERAND8))))
+OPCODE(0xED, sbc(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xFD, sbc(cpu, readmemory(cpu, absolutex(cpu, OPERAND16))))
+OPCODE(0xF9, sbc(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0xE1, sbc(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0xF1, sbc(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0x38, sec(cpu))
+OPCODE(0xF8, sed(cpu))
+OPCODE(0x78, sei(cpu))
+
+OPCODE(0x85, sta(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x95, sta(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x8D, sta(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x9D, sta(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x99, sta(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x81, sta(cpu, indirectx(cpu, OPERAND8)))
+OPCODE(0x91, sta(cpu, indirecty(cpu, OPERAND8)))
+
+OPCODE(0x86, stx(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x96, stx(cpu, zeropagey(cpu, OPERAND8)))
+OPCODE(0x8E, stx(cpu, absolute(cpu, OPERAND16)))
+
+OPCODE(0x84, sty(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x94, sty(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x8C, sty(cpu, absolute(cpu, OPERAND16)))
+
+OPCODE(0xAA, tax(cpu))
+OPCODE(0xA8, tay(cpu))
+OPCODE(0xBA, tsx(cpu))
+OPCODE(0x8A, txa(cpu))
+OPCODE(0x9A, txs(cpu))
+OPCODE(0x98, tya(cpu))
+
+//
+// Below opcodes are undocumented and rarely used. Yet they are
+// required for proper emulation of specific software.
+//
+OPCODE(0x0B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); anc(cpu, OPERAND8))
+OPCODE(0x2B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); anc(cpu, OPERAND8))
+
+OPCODE(0x0F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x1F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x1B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x07, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x17, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x03, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, indirectx(cpu, OPERAND8)))
+OPCODE(0x13, diagnostic(cpu, command, DIAG_UNDOCUMENTED); slo(cpu, indirecty(cpu, OPERAND8)))
+
+OPCODE(0xA7, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, zeropage(cpu, OPERAND8))))
+OPCODE(0xB7, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, zeropagey(cpu, OPERAND8))))
+OPCODE(0xAF, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, absolute(cpu, OPERAND16))))
+OPCODE(0xBF, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+OPCODE(0xA3, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, indirectx(cpu, OPERAND8))))
+OPCODE(0xB3, diagnostic(cpu, command, DIAG_UNDOCUMENTED); lax(cpu, readmemory(cpu, indirecty(cpu, OPERAND8))))
+
+OPCODE(0x87, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sax(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x97, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sax(cpu, zeropagey(cpu, OPERAND8)))
+OPCODE(0x8F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sax(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x83, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sax(cpu, indirectx(cpu, OPERAND8)))
+
+OPCODE(0x47, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x57, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x4F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x5F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x5B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x43, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, indirectx(cpu, OPERAND8)))
+OPCODE(0x53, diagnostic(cpu, command, DIAG_UNDOCUMENTED); sre(cpu, indirecty(cpu, OPERAND8)))
+
+OPCODE(0x27, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x37, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x2F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0x3F, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x3B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x23, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, indirectx(cpu, OPERAND8)))
+OPCODE(0x33, diagnostic(cpu, command, DIAG_UNDOCUMENTED); rla(cpu, indirecty(cpu, OPERAND8)))
+
+OPCODE(0x4B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); alr(cpu, OPERAND8))
+
+OPCODE(0xBB, diagnostic(cpu, command, DIAG_UNDOCUMENTED); las(cpu, readmemory(cpu, absolutey(cpu, OPERAND16))))
+
+OPCODE(0x6B, diagnostic(cpu, command, DIAG_UNDOCUMENTED); arr(cpu, OPERAND8))
+
+OPCODE(0xEB, sbc(cpu, OPERAND8))
+
+OPCODE(0xCB, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); sbx(cpu, OPERAND8))
+
+OPCODE(0xC7, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0xD7, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0xCF, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, absolute(cpu, OPERAND16)))
+OPCODE(0xDF, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0xDB, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0xC3, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, indirectx(cpu, OPERAND8)))
+OPCODE(0xD3, diagnostic(cpu, command, DIAG_UNDOCUMENTED); dcp(cpu, indirecty(cpu, OPERAND8)))
+
+//
+// Multiple opcodes generate nops with different address modes)
+//
+OPCODE(0x80, diagnostic(cpu, command, DIAG_NOP); nop(cpu, OPERAND8))
+OPCODE(0x82, diagnostic(cpu, command, DIAG_NOP); nop(cpu, OPERAND8))
+OPCODE(0x89, diagnostic(cpu, command, DIAG_NOP); nop(cpu, OPERAND8))
+OPCODE(0xC2, diagnostic(cpu, command, DIAG_NOP); nop(cpu, OPERAND8))
+OPCODE(0xE2, diagnostic(cpu, command, DIAG_NOP); nop(cpu, OPERAND8))
+
+OPCODE(0x04, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x44, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropage(cpu, OPERAND8)))
+OPCODE(0x64, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropage(cpu, OPERAND8)))
+
+OPCODE(0x14, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x34, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x54, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0x74, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0xD4, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+OPCODE(0xF4, diagnostic(cpu, command, DIAG_NOP); nop(cpu, zeropagex(cpu, OPERAND8)))
+
+OPCODE(0x0C, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolute(cpu, OPERAND16)))
+
+//
+// These nops use ABSOLUTE_X addressing mode, which affect timing
+// in case of page border cross
+//
+OPCODE(0x1C, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x3C, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x5C, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x7C, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0xDC, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0xFC, diagnostic(cpu, command, DIAG_NOP); nop(cpu, absolutex(cpu, OPERAND16)))
+
+//
+// Opcodes below cause CPU to halt execution and are called
+// JAM by some assemblers. We do not implement JAM, treating
+// them as NOPS, but we report a diagnostic.
+//
+OPCODE(0x02, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x12, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x22, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x32, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x42, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x52, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x62, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x72, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0x92, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0xB2, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0xD2, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+OPCODE(0xF2, diagnostic(cpu, command, DIAG_JAM); nop(cpu, 0))
+
+//
+// Unstable opcodes are not yet implemented but report a diagnostic
+//
+OPCODE(0x93, diagnostic(cpu, command, DIAG_UNSTABLE); sha(cpu, indirecty(cpu, OPERAND8)))
+OPCODE(0x9F, diagnostic(cpu, command, DIAG_UNSTABLE); sha(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x9E, diagnostic(cpu, command, DIAG_UNSTABLE); shx(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x9C, diagnostic(cpu, command, DIAG_UNSTABLE); shy(cpu, absolutex(cpu, OPERAND16)))
+OPCODE(0x9B, diagnostic(cpu, command, DIAG_UNSTABLE); tas(cpu, absolutey(cpu, OPERAND16)))
+OPCODE(0x8B, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); ane(cpu, OPERAND8))
+OPCODE(0xAB, diagnostic(cpu, command, DIAG_UNSTABLE); lxa(cpu, OPERAND8))
+
+//
+// Undocumented NOPs (1A, 3A, 5A, 7A, DA, FA), plus the RRA and ISC opcodes
+// which are not implemented yet and run as NOPs.
+//
+OPCODE(0x1A, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0x3A, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0x5A, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0x7A, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0xDA, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0xFA, diagnostic(cpu, command, DIAG_NOP); nop(cpu, 0))
+OPCODE(0x63, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x67, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x6F, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x73, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x77, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x7B, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0x7F, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xE3, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xE7, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xEF, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xF3, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xF7, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xFB, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
+OPCODE(0xFF, diagnostic(cpu, command, DIAG_UNIMPLEMENTED); nop(cpu, 0))
@@ -11,13 +11,21 @@
 //
 // https://github.com/Klaus2m5/6502_65C02_functional_tests/tree/master/bin_files
 //
+// Run it as "test6502 blocks" to use the block cache, "test6502 jit" to
+// run the test with the JIT compiler, or "test6502 exact" to run it on the
+// cycle exact engine. "test6502 profile" saves the profile of the test in
+// test6502.profile and test6502.stacks.
+//
 // nelbr - June/July 2020
 //
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include "6502.h"
 
 unsigned char memory[65536];
+struct microprocessor cpu;
 
 //
 // Read binary file in memory
@@ -41,6 +49,7 @@ int rominit()
 //
 void boot()
 {
+    initcpu(&cpu);
     cpu.a = 0x00;
     cpu.x = 0x00;
     cpu.y = 0x00;
@@ -48,29 +57,24 @@ void boot()
     cpu.pc= 0x0400;
     cpu.status= 0x20;
     cpu.cycles= 0;
-}
-//
-// Readmemory routine in this example just returns value of 64K array
-//
-unsigned char readmemory(unsigned short address)
-{
-    unsigned char result;
-    result = memory[address];
-    return result;
-}
 
-//
-// Writememory routine in this example just sets value of 64K array
-//
-void writememory(unsigned short address, unsigned char value)
-{
-    memory[address] = value;
+    //
+    // The whole 64K address space is RAM backed by the memory array, so 
+    // every bus access goes directly to the array
+    //
+    mapmemory(&cpu, 0x00, 256, memory);
+
+    //
+    // Print the undocumented opcodes executed, at most 10 per second of a
+    // 1 Mhz machine
+    //
+    setdiagnostics(&cpu, printdiagnostic, stdout, 10, 1000000);
 }
 
 //
 // Main function of test routine
 //
-int main()
+int main(int argc, char *argv[])
 {
     struct timeval start,stop;
     long seconds, micros; 
@@ -88,6 +92,22 @@ int main()
     // Initialize cpu registers
     //
     boot();
+
+    //
+    // With "blocks" on the command line the opcodes run from the block cache,
+    // with "jit" the hot blocks are also compiled to host code (the library
+    // must be built with make DEFINES=-DJIT). With "exact" the test runs on the
+    // cycle exact engine, compare its speed with the default run.
+    //
+    if (argc > 1 && (!strcmp(argv[1], "blocks") || !strcmp(argv[1], "jit"))) {
+        setblockcache(&cpu, malloc(sizeof(struct blockcache)));
+        if (!strcmp(argv[1], "jit") && setjit(&cpu, 1 << 20)) {
+            printf("Could not start the JIT, build the library with make DEFINES=-DJIT\n");
+            return 0;
+        }
+    }
+    if (argc > 1 && !strcmp(argv[1], "exact")) setcycleexact(&cpu, 1);
+    if (argc > 1 && !strcmp(argv[1], "profile")) setprofile(&cpu, malloc(sizeof(struct profile)));
     printf ("Running test, please wait a bit\n");
 
     //
@@ -96,27 +116,25 @@ int main()
     gettimeofday(&start, NULL);
 
     //
-    // Main loop, sequentially execute commands pointed by the program counter
-    // register in the CPU. 
+    // Main loop, execute the test in frames of 20000 cycles (20 ms of a 1 Mhz
+    // machine). The library runs the opcodes of a frame in a tight loop, we only
+    // need to check the test progress between frames. 
+    //
+    // To trace command execution, pass a buffer of records to settrace before
+    // the loop, e.g. settrace(&cpu, records, 65536), then savetrace(&cpu, 
+    // "test6502.trace") after it and decode the file with tracedump6502. The
+    // buffer keeps the last 65536 opcodes, which is usually what you need to
+    // find out where a test got stuck.
     //
-    while (processcommand()==0) 
+    while (1) 
     {
-        // 
-        // We can set debug to trace command execution on stderr. 
-        // Careful though, this will generate a substantial amount of output
-        //
-        #ifdef DEBUG
-        if (used) fprintf (stderr, " A=%02X, X=%02X, Y=%02X, SP=%02X, PC=%02X, STATUS=%02X", cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.status); 
-        else fprintf (stderr, "      A=%02X, X=%02X, Y=%02X, SP=%02X, PC=%02X, STATUS=%02X", cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.status); 
-        fprintf(stderr, STATUS_TO_BINARY_PATTERN, STATUS_TO_BINARY(cpu.status));
-        used=0;
-        #endif 
+        runcycles(&cpu, 20000);
 
         //
         // Uncomment this printf if you would like to check which test is executing.
         // Can be useful for finding our which test is failing, but increases execution time
         //
-        // printf ("Teste numero %2X %2X %2X %i\n", memory[0x200], memory[0x203], memory[0x204], counter);
+        // printf ("Teste numero %2X %2X %2X\n", memory[0x200], memory[0x203], memory[0x204]);
 
         // 
         // When we reach test F0 we have finished the test suite
@@ -137,6 +155,10 @@ int main()
     printf ("Number of cycles spent = %ld\n", cpu.cycles);
     printf ("Test completed successfully in %ld us\n",micros);
     printf ("Estimated CPU speed in this computer = %ld Mhz\n", (cpu.cycles/micros));
+    if (cpu.profile) {
+        printf ("Profile of %ld addresses saved in test6502.profile\n", saveprofile(&cpu, "test6502.profile"));
+        printf ("%ld call stacks saved in test6502.stacks\n", savestacks(&cpu, "test6502.stacks"));
+    }
     // printf ("BREAK A=%02X, X=%02X, Y=%02X, SP=%02X, PC=%04X, STATUS=%02X\n", cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.status); 
     
     //
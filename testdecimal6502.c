@@ -11,13 +11,20 @@
 //
 // https://github.com/Klaus2m5/6502_65C02_functional_tests/tree/master/bin_files
 //
+// Run it as "testdecimal6502 blocks" to use the block cache, 
+// "testdecimal6502 jit" to run the test with the JIT compiler, or
+// "testdecimal6502 exact" to run it on the cycle exact engine.
+//
 // nelbr - June/July 2020
 //
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include "6502.h"
 
 unsigned char memory[65536];
+struct microprocessor cpu;
 
 //
 // Read binary file in memory
@@ -35,12 +42,27 @@ int rominit()
     return 0;
 }
        
+//
+// Stack page handlers used with the block cache, see main
+//
+unsigned char stackread(void *context, unsigned short address)
+{
+    if (address < 0x102) stoprun(&cpu);
+    return memory[address];
+}
+
+void stackwrite(void *context, unsigned short address, unsigned char value)
+{
+    memory[address] = value;
+}
+
 //
 // Initialize 6502 processor registers. The test program code 
 // starts at address 0x0400
 //
 void boot()
 {
+    initcpu(&cpu);
     cpu.a = 0x00;
     cpu.x = 0x00;
     cpu.y = 0x00;
@@ -48,29 +70,24 @@ void boot()
     cpu.pc= 0x0200;
     cpu.status= 0x20;
     cpu.cycles= 0;
-}
-//
-// Readmemory routine in this example just returns value of 64K array
-//
-unsigned char readmemory(unsigned short address)
-{
-    unsigned char result;
-    result = memory[address];
-    return result;
-}
 
-//
-// Writememory routine in this example just sets value of 64K array
-//
-void writememory(unsigned short address, unsigned char value)
-{
-    memory[address] = value;
+    //
+    // The whole 64K address space is RAM backed by the memory array, so 
+    // every bus access goes directly to the array
+    //
+    mapmemory(&cpu, 0x00, 256, memory);
+
+    //
+    // Print the undocumented opcodes executed, at most 10 per second of a
+    // 1 Mhz machine
+    //
+    setdiagnostics(&cpu, printdiagnostic, stdout, 10, 1000000);
 }
 
 //
 // Main function of test routine
 //
-int main()
+int main(int argc, char *argv[])
 {
     struct timeval start,stop;
     long seconds, micros; 
@@ -88,6 +105,21 @@ int main()
     // Initialize cpu registers
     //
     boot();
+
+    //
+    // With "blocks" on the command line the opcodes run from the block cache,
+    // with "jit" the hot blocks are also compiled to host code (the library
+    // must be built with make DEFINES=-DJIT). With "exact" the test runs on the
+    // cycle exact engine, compare its speed with the default run.
+    //
+    if (argc > 1 && (!strcmp(argv[1], "blocks") || !strcmp(argv[1], "jit"))) {
+        setblockcache(&cpu, malloc(sizeof(struct blockcache)));
+        if (!strcmp(argv[1], "jit") && setjit(&cpu, 1 << 20)) {
+            printf("Could not start the JIT, build the library with make DEFINES=-DJIT\n");
+            return 0;
+        }
+    }
+    if (argc > 1 && !strcmp(argv[1], "exact")) setcycleexact(&cpu, 1);
     printf ("Running test, please wait a bit\n");
 
     //
@@ -97,21 +129,19 @@ int main()
 
     //
     // Main loop, sequentially execute commands pointed by the program counter
-    // register in the CPU. 
+    // register in the CPU. The test ends returning to an address below 0x200,
+    // so the pc is checked after every opcode instead of using runcycles. 
     //
-    while (processcommand()==0) 
+    // The block cache is only used by runcycles. The final rts pulls its 
+    // address from the empty stack, at 0x100 and 0x101 after sp wraps, so 
+    // the stack page is mapped to handlers stopping the run right there.
+    //
+    if (cpu.blocks) {
+        mapio(&cpu, 0x01, 1, stackread, stackwrite, 0);
+        while (cpu.pc>=0x200) runcycles(&cpu, 20000);
+    }
+    else while (processcommand(&cpu)==0) 
     {
-        // 
-        // We can set debug to trace command execution on stderr. 
-        // Careful though, this will generate a substantial amount of output
-        //
-        #ifdef DEBUG
-        if (used) fprintf (stderr, " A=%02X, X=%02X, Y=%02X, SP=%02X, PC=%02X, STATUS=%02X", cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.status); 
-        else fprintf (stderr, "      A=%02X, X=%02X, Y=%02X, SP=%02X, PC=%02X, STATUS=%02X", cpu.a, cpu.x, cpu.y, cpu.sp, cpu.pc, cpu.status); 
-        fprintf(stderr, STATUS_TO_BINARY_PATTERN, STATUS_TO_BINARY(cpu.status));
-        used=0;
-        #endif 
-
         if (cpu.pc<0x200) break;
         // printf ("PC=%4X Op=%2X A=%2X X=%2X Y=%2X P=%2X, DesiredP=%2X N1=%2X, N2=%2X DA=%2X, AR=%2X DNVZC=%2X VF=%2X\n", cpu.pc, memory[cpu.pc], cpu.a, cpu.x, cpu.y, cpu.status, memory[0x0005], memory[0x0000], memory[0x0001], memory[0x0004], memory[0x0006], memory[0x0005], memory[0x0008]); 
 
@@ -0,0 +1,152 @@
+//
+// 6502 emulator written in C
+//
+// An education project for me to learn about 6502 emulation
+//
+// Maybe a long term goal of extending this into an apple 2 emulator
+//
+// This program decodes a trace file saved by savetrace into text, one opcode
+// per two lines, in the same format the old DEBUG build printed on stderr:
+// the opcode, the address it referenced and its mnemonic, then the registers
+// after the opcode. With -c each opcode is preceded by the cycle count, and
+// with -d the mnemonic is replaced by the disassembled opcode with its operand.
+//
+//    usage: tracedump6502 [-c] [-d] file
+//
+#include <stdio.h>
+#include <string.h>
+#include "6502.h"
+
+#define STATUS_TO_BINARY_PATTERN "     Ne %c Ov %c NA %c Br %c De %c In %c Ze %c Ca %c\n"
+#define STATUS_TO_BINARY(byte)  \
+  (byte & 0x80 ? '1' : '0'), \
+  (byte & 0x40 ? '1' : '0'), \
+  (byte & 0x20 ? '1' : '0'), \
+  (byte & 0x10 ? '1' : '0'), \
+  (byte & 0x08 ? '1' : '0'), \
+  (byte & 0x04 ? '1' : '0'), \
+  (byte & 0x02 ? '1' : '0'), \
+  (byte & 0x01 ? '1' : '0')
+
+//
+// Read one record from the file, in the layout written by savetrace. Returns
+// 0 at the end of the file.
+//
+int readrecord(FILE *fp, struct tracerecord *record)
+{
+    unsigned char bytes[TRACE_RECORDSIZE];
+
+    if (fread(bytes, 1, TRACE_RECORDSIZE, fp) != TRACE_RECORDSIZE) return 0;
+    record->cycles = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int) bytes[3] << 24;
+    record->pc = (unsigned short) (bytes[4] | bytes[5] << 8);
+    record->address = (unsigned short) (bytes[6] | bytes[7] << 8);
+    record->opcode = bytes[8];
+    record->operand[0] = bytes[9];
+    record->operand[1] = bytes[10];
+    record->a = bytes[11];
+    record->x = bytes[12];
+    record->y = bytes[13];
+    record->sp = bytes[14];
+    record->status = bytes[15];
+    return 1;
+}
+
+//
+// The pc after an opcode is the pc of the next record. For the last record
+// of the file it is worked out from the opcode, when possible (returns -1 for
+// returns, brk and indirect jumps).
+//
+long nextpc(struct tracerecord *record)
+{
+    static const unsigned char branchflag[8] = { 0x80, 0x80, 0x40, 0x40, 0x01, 0x01, 0x02, 0x02 };
+    unsigned short pc = record->pc + 1;
+    unsigned char opcode = record->opcode;
+    const struct opcodeinfo *info = &opcodeinfo[opcode];
+    int taken;
+
+    if (opcode == 0x00 || opcode == 0x40 || opcode == 0x60 || info->mode == MODE_IND) return -1;
+    if (opcode == 0x20 || opcode == 0x4C) return record->operand[0] | record->operand[1] << 8;
+    pc += (info->flags & OPCODE_SIZE) - 1;
+    if (info->mode == MODE_REL) {
+        // bit 5 of the opcode tells if the branch is taken on flag set or clear
+        taken = ((record->status & branchflag[opcode >> 5]) != 0) == ((opcode & 0x20) != 0);
+        if (taken) pc += (signed char) record->operand[0];
+    }
+    return (unsigned short) pc;
+}
+
+void printrecord(struct tracerecord *record, long pc, int cycles, int disasm, unsigned long long total)
+{
+    const struct opcodeinfo *info = &opcodeinfo[record->opcode];
+    unsigned char bytes[3] = { record->opcode, record->operand[0], record->operand[1] };
+    char text[DISASM_TEXTSIZE];
+    struct disasmop op;
+    int jump = record->opcode == 0x20 || record->opcode == 0x4C;
+    int used = (info->mode >= MODE_ZP && !jump) || record->opcode == 0x20;
+
+    if (cycles) printf("%10llu ", total);
+    printf("%2X ", record->opcode);
+    if (info->mode >= MODE_ZP && !jump) printf("%04X ", record->address);
+    if (disasm) {
+        disassemble(bytes, info->flags & OPCODE_SIZE, record->pc, &op);
+        formatopcode(&op, text);
+        printf("%s ", text);
+    }
+    else if (record->opcode == 0x20) printf("jsr %04X ", record->operand[0] | record->operand[1] << 8);
+    else printf("%s ", opcodenames[info->mnemonic]);
+    printf("\n");
+    printf(used ? " A=%02X, X=%02X, Y=%02X, SP=%02X, " : "      A=%02X, X=%02X, Y=%02X, SP=%02X, ",
+           record->a, record->x, record->y, record->sp);
+    if (pc < 0) printf("PC=????, ");
+    else printf("PC=%02lX, ", pc);
+    printf("STATUS=%02X", record->status);
+    printf(STATUS_TO_BINARY_PATTERN, STATUS_TO_BINARY(record->status));
+}
+
+int main(int argc, char *argv[])
+{
+    struct tracerecord record, next;
+    unsigned long long total;
+    char magic[8];
+    int cycles = 0, disasm = 0;
+    int more;
+    FILE *fp;
+
+    for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+        if (!strcmp(argv[1], "-c")) cycles = 1;
+        else if (!strcmp(argv[1], "-d")) disasm = 1;
+        else break;
+    }
+    if (argc != 2) {
+        printf("usage: tracedump6502 [-c] [-d] file\n");
+        return 1;
+    }
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        printf("Could not open trace file %s\n", argv[1]);
+        return 1;
+    }
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRACE_MAGIC, 8)) {
+        printf("%s is not a 6502 trace file\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    //
+    // Each record is printed once the next one is read, to get the pc after
+    // the opcode. The cycle count is 32 bits in the file, it is extended
+    // assuming less than 2^32 cycles between two records.
+    //
+    more = readrecord(fp, &record);
+    total = more ? record.cycles : 0;
+    while (more) {
+        more = readrecord(fp, &next);
+        printrecord(&record, more ? next.pc : nextpc(&record), cycles, disasm, total);
+        if (more) {
+            total += (unsigned int) (next.cycles - record.cycles);
+            record = next;
+        }
+    }
+    fclose(fp);
+    return 0;
+}